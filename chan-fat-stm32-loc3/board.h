@@ -102,6 +102,11 @@ Check port settings against those set in the board.h header.
  #define SPI_SD                   SPI2
  #define DMA_CHANNEL_SPI_SD_RX    DMA_CHANNEL4
  #define DMA_CHANNEL_SPI_SD_TX    DMA_CHANNEL5
+/* DMA1 channel 4 is shared with USART1 TX, which must be held off */
+ #define DMA_SPI_SD_SHARES_USART1_TX
+/* Multiple block writes may run in the background. The hardware module calls
+disk_dma_isr() from the channel 4 ISR while the channel is lent to the card. */
+ #define STM32_SD_ASYNC_WRITE
  #define DMA_FLAG_SPI_SD_TC_RX    DMA_TCIF
  #define DMA_FLAG_SPI_SD_TC_TX    DMA_TCIF
  #define GPIO_PORT_SPI_SD         GPIOB
@@ -35,6 +35,12 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+/* Asynchronous multiple block writes of the SD SPI driver */
+void disk_set_async (BYTE on);
+BYTE disk_busy (void);
+void disk_poll (void);
+void disk_dma_isr (void);
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -46,6 +46,7 @@ typedef bool BOOL;
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/spi.h>
 #include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/cortex.h>
 #include "ffconf.h"
 #include "diskio.h"
 #include "board.h"
@@ -55,6 +56,16 @@ typedef bool BOOL;
 #pragma message "*** Using DMA for MMC Card Access ***"
 #endif
 
+#if defined STM32_SD_ASYNC_WRITE && !defined STM32_SD_USE_DMA
+#error "Asynchronous writes need DMA"
+#endif
+
+#ifdef DMA_SPI_SD_SHARES_USART1_TX
+/* These are provided in the hardware module */
+extern void comms_transmit_lend(void);
+extern void comms_transmit_reclaim(void);
+#endif
+
 #ifdef USE_ET_STM32F103
 // #warning "Information only: using ET_STM32F103"
 #pragma message "*** Using ET_STM32F103 board ***"
@@ -114,6 +125,22 @@ static volatile DWORD Timer1;               /* 100Hz decrement timers */
 
 static BYTE CardType;			            /* Card type flags */
 
+#ifdef STM32_SD_USE_DMA
+static WORD rw_workbyte[] = { 0xffff };     /* DMA source/sink for dummy bytes */
+#endif
+
+#ifdef STM32_SD_ASYNC_WRITE
+/* Asynchronous multiple block write state. The data block DMA is completed in
+disk_dma_isr() and the card busy state is polled in disk_poll(). */
+enum async_state { ASYNC_IDLE, ASYNC_DMA, ASYNC_BUSY, ASYNC_STOP };
+static volatile enum async_state asyncState = ASYNC_IDLE;
+static const BYTE* asyncBuffer;             /* next data block */
+static volatile UINT asyncCount;            /* data blocks remaining */
+static volatile BOOL asyncError;            /* a data block was rejected */
+static volatile DWORD asyncTimer;           /* start of the busy wait */
+#endif
+static BOOL asyncWrite;                     /* next multiple block write async */
+
 /*---------------------------------------------------------------------------*/
 /** @brief Check for timeout
 
@@ -380,16 +407,21 @@ static void release_spi(void)
 
 #ifdef STM32_SD_USE_DMA
 /*---------------------------------------------------------------------------*/
-/** @brief Transmit/Receive Block using DMA
+/** @brief Start a Block Transmit/Receive using DMA
 
 @param[in] receive: Boolean false for sending to SPI, true for reading
 @param[in] *buff: Pointer to buffer of BYTE
 @param[in] btr: UINT byte count (multiple of 2 for send, 512 always for receive)
+@param[in] interrupt: Boolean true to interrupt on completion of the transfer
 */
 
-static void stm32_dma_transfer(BOOL receive, const BYTE *buff, UINT btr)
+static void stm32_dma_start(BOOL receive, const BYTE *buff, UINT btr,
+                            BOOL interrupt)
 {
-	WORD rw_workbyte[] = { 0xffff };
+#ifdef DMA_SPI_SD_SHARES_USART1_TX
+/* Take the DMA channel from the USART transmitter for this transfer */
+    comms_transmit_lend();
+#endif
 
 /* Enable DMA1 Clock */
 	rcc_peripheral_enable_clock(&RCC_AHBENR, RCC_AHBENR_DMA1EN);
@@ -443,6 +475,10 @@ static void stm32_dma_transfer(BOOL receive, const BYTE *buff, UINT btr)
 #endif
 	}
 
+/* The receive channel completes last */
+    if (interrupt)
+        dma_enable_transfer_complete_interrupt(DMA1,DMA_CHANNEL_SPI_SD_RX);
+
 /* Enable DMA Channels */
 	dma_enable_channel(DMA1,DMA_CHANNEL_SPI_SD_RX);
 	dma_enable_channel(DMA1,DMA_CHANNEL_SPI_SD_TX);
@@ -450,9 +486,18 @@ static void stm32_dma_transfer(BOOL receive, const BYTE *buff, UINT btr)
 /* Enable SPI TX/RX requests */
     spi_enable_rx_dma(SPI_SD);
     spi_enable_tx_dma(SPI_SD);
+}
 
-/* Wait until DMA1_CHANNEL 2 Receive Complete */
-    while (! dma_get_interrupt_flag(DMA1,DMA_CHANNEL_SPI_SD_RX,DMA_TCIF));
+/*---------------------------------------------------------------------------*/
+/** @brief Finish a Block Transmit/Receive using DMA
+
+The DMA channels are released once the receive channel has completed.
+*/
+
+static void stm32_dma_stop(void)
+{
+    dma_clear_interrupt_flags(DMA1,DMA_CHANNEL_SPI_SD_RX,DMA_TCIF);
+    dma_disable_transfer_complete_interrupt(DMA1,DMA_CHANNEL_SPI_SD_RX);
 
 /* Disable DMA Channels */
     dma_disable_channel(DMA1,DMA_CHANNEL_SPI_SD_RX);
@@ -461,9 +506,76 @@ static void stm32_dma_transfer(BOOL receive, const BYTE *buff, UINT btr)
 /* Disable SPI RX/TX requests */
     spi_disable_rx_dma(SPI_SD);
     spi_disable_tx_dma(SPI_SD);
+
+#ifdef DMA_SPI_SD_SHARES_USART1_TX
+    comms_transmit_reclaim();
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Transmit/Receive Block using DMA
+
+The processor waits for the transfer to complete.
+
+@param[in] receive: Boolean false for sending to SPI, true for reading
+@param[in] *buff: Pointer to buffer of BYTE
+@param[in] btr: UINT byte count (multiple of 2 for send, 512 always for receive)
+*/
+
+static void stm32_dma_transfer(BOOL receive, const BYTE *buff, UINT btr)
+{
+    stm32_dma_start(receive, buff, btr, FALSE);
+
+/* Wait until DMA1_CHANNEL 2 Receive Complete */
+    while (! dma_get_interrupt_flag(DMA1,DMA_CHANNEL_SPI_SD_RX,DMA_TCIF));
+
+    stm32_dma_stop();
 }
 #endif /* STM32_SD_USE_DMA */
 
+#ifdef STM32_SD_ASYNC_WRITE
+/*---------------------------------------------------------------------------*/
+/** @brief Start the next data block of an asynchronous write
+
+The card must be ready. The data token is sent and the block is passed to DMA,
+to be completed in disk_dma_isr().
+*/
+
+static void async_next_block(void)
+{
+    asyncTimer = Timer1;
+    asyncState = ASYNC_DMA;
+    xmit_spi(0xFC);                     /* multiple block data token */
+    stm32_dma_start(FALSE, asyncBuffer, 512, TRUE);
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Wait for an asynchronous write to finish
+
+The state machine is run here until it is idle, which disk_poll() ensures by
+abandoning a data block or a busy card after a timeout. This is called before
+any other card access.
+
+@returns DRESULT RES_OK, or RES_ERROR if the write had failed.
+*/
+
+static DRESULT async_wait(void)
+{
+    while (asyncState != ASYNC_IDLE) disk_poll();
+    if (asyncError)
+    {
+        asyncError = FALSE;
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+#else
+static DRESULT async_wait(void)
+{
+    return RES_OK;
+}
+#endif /* STM32_SD_ASYNC_WRITE */
+
 /*---------------------------------------------------------------------------*/
 /** @brief Power Control and Interface-Initialization
 
@@ -728,6 +840,7 @@ DSTATUS disk_initialize(BYTE drv)
 {
 	BYTE n, cmd, ty, ocr[4];
 
+    async_wait();
 	if (drv > 0) return STA_NOINIT;			    /* Supports only single drive */
 	if (diskStatus & STA_NODISK) return diskStatus;	/* No card in the socket */
 
@@ -835,6 +948,7 @@ DRESULT disk_read(BYTE drv, BYTE* buff, DWORD sector, UINT count)
     {
         res = RES_NOTRDY;
     }
+    if (res == RES_OK) res = async_wait();
     if (res == RES_OK)
     {
 /* Convert to byte address if needed */
@@ -878,6 +992,11 @@ DRESULT disk_read(BYTE drv, BYTE* buff, DWORD sector, UINT count)
 
 Only compiled if disk is not read only.
 
+A multiple block write is done asynchronously if this was requested by
+disk_set_async(). The write is then only started here and is finished by the
+DMA interrupt and disk_poll(), so the buffer must be left untouched until then.
+A failure is reported by the next disk access.
+
 @param[in] drv: BYTE Physical drive number (only 0 allowed)
 @param[in] *buff: BYTE Pointer to buffer
 @param[in] sector: DWORD starting sector number
@@ -905,6 +1024,7 @@ DRESULT disk_write(BYTE drv, const BYTE* buff, DWORD sector, UINT count)
     {
         res = RES_WRPRT;
     }
+    if (res == RES_OK) res = async_wait();
     if (res == RES_OK)
     {
 /* Convert to byte address if needed */
@@ -928,6 +1048,16 @@ DRESULT disk_write(BYTE drv, const BYTE* buff, DWORD sector, UINT count)
 /* If the response to the command is non-zero, the block is not written */
             if ((error = send_cmd(CMD25, sector)) == 0)
             {
+#ifdef STM32_SD_ASYNC_WRITE
+/* Leave the card selected for the blocks to be sent in the background */
+                if (asyncWrite)
+                {
+                    asyncBuffer = buff;
+                    asyncCount = count;
+                    async_next_block();
+                    return RES_OK;
+                }
+#endif
                 do
                 {
                     if (!xmit_datablock(buff, 0xFC)) break;
@@ -978,6 +1108,10 @@ DRESULT disk_ioctl(BYTE drv,BYTE ctrl,void *buff)
     {
         res = RES_PARERR;
     }
+    else if (async_wait() != RES_OK)
+    {
+        res = RES_ERROR;
+    }
     else
     {
         if (ctrl == CTRL_POWER)
@@ -1164,3 +1298,117 @@ void disk_timerproc(void)
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+/** @brief Request Asynchronous Multiple Block Writes
+
+While set, multiple block writes are started by disk_write() and completed in
+the background. The caller must not change the buffer until the next disk
+access, or until disk_busy() is false.
+
+@param[in] on: BYTE nonzero to write asynchronously.
+*/
+
+void disk_set_async(BYTE on)
+{
+    asyncWrite = (on != 0);
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Check for an Asynchronous Write in Progress
+
+@returns BYTE nonzero while a write is in progress.
+*/
+
+BYTE disk_busy(void)
+{
+#ifdef STM32_SD_ASYNC_WRITE
+    return (asyncState != ASYNC_IDLE);
+#else
+    return 0;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Poll an Asynchronous Write
+
+This must be called regularly from the main program. While the card is
+programming a data block it holds its data output low. Once it is ready the
+next data block is started, or the stop token is sent after the last. The card
+is released when it has finished. A data block transfer that has not completed,
+or a card that stays busy, is abandoned after 500ms with an error.
+
+Globals Timer1: DWORD incremented in the systick ISR by 10ms.
+*/
+
+void disk_poll(void)
+{
+#ifdef STM32_SD_ASYNC_WRITE
+    if (asyncState == ASYNC_DMA)
+    {
+        if (! timeout(asyncTimer,50)) return;
+/* Recheck with interrupts off as the transfer may complete meanwhile */
+        cm_disable_interrupts();
+        if (asyncState == ASYNC_DMA)
+        {
+            stm32_dma_stop();
+            asyncError = TRUE;
+            asyncState = ASYNC_IDLE;
+            cm_enable_interrupts();
+            release_spi();
+            return;
+        }
+        cm_enable_interrupts();
+    }
+    if ((asyncState != ASYNC_BUSY) && (asyncState != ASYNC_STOP)) return;
+    if (rcvr_spi() == 0xFF)
+    {
+        if (asyncState == ASYNC_STOP)
+        {
+            release_spi();
+            asyncState = ASYNC_IDLE;
+        }
+        else if ((asyncCount > 0) && !asyncError) async_next_block();
+        else
+        {
+            xmit_spi(0xFD);             /* STOP_TRAN token */
+            rcvr_spi();                 /* skip a byte before busy */
+            asyncTimer = Timer1;
+            asyncState = ASYNC_STOP;
+        }
+    }
+    else if (timeout(asyncTimer,50))
+    {
+        asyncError = TRUE;
+        release_spi();
+        asyncState = ASYNC_IDLE;
+    }
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief DMA Transfer Complete Interrupt Procedure
+
+This must be called from the ISR of the DMA channel receiving from the SD card.
+A data block of an asynchronous write has been sent. The CRC is sent and the
+data response is checked, then the card is left to program the block.
+*/
+
+void disk_dma_isr(void)
+{
+#ifdef STM32_SD_ASYNC_WRITE
+    if (asyncState != ASYNC_DMA)
+    {
+        dma_clear_interrupt_flags(DMA1,DMA_CHANNEL_SPI_SD_RX,DMA_TCIF);
+        return;
+    }
+    stm32_dma_stop();
+    xmit_spi(0xFF);                     /* CRC (Dummy) */
+    xmit_spi(0xFF);
+    if ((rcvr_spi() & 0x1F) != 0x05) asyncError = TRUE;
+    asyncBuffer += 512;
+    asyncCount--;
+    asyncTimer = Timer1;
+    asyncState = ASYNC_BUSY;
+#endif
+}
+
@@ -30,17 +30,34 @@ Note these definitions cannot be placed in the header file.
 #include <stdint.h>
 #include <stdbool.h>
 
-#include "data-acquisition-objdic.h"
 #include "../libs/hardware.h"
+#include "../libs/comms.h"
+#include "../libs/file.h"
+#include "data-acquisition-objdic.h"
 
-/* Byte pattern that indicates if a valid NVM config data block is present */
-#define VALID_BLOCK                 0xD5
+/* Byte pattern that indicates if a valid NVM config data block is present.
+Change it whenever the layout of struct Config changes, so that a block saved
+by earlier firmware is replaced by the defaults. */
+#define VALID_BLOCK                 0xD6
 
 /*--------------------------------------------------------------------------*/
 /* Preset the config data block in FLASH to a given pattern to indicate unused. */
 union ConfigGroup configDataBlock __attribute__ ((section (".configBlock"))) = {{0xA5}};
 union ConfigGroup configData;
 
+/*--------------------------------------------------------------------------*/
+/* Message idents in order of their object index for binary frames, from 1.
+Trailing digits of an ident are not listed as they are sent as a subindex.
+New idents must be added at the end to keep existing indices. */
+const char* const telemetryIndex[] =
+{
+    "pH", "pB", "dT", "dt", "dB", "dI", "dQ", "ds", "dR", "dr",
+    "dX", "dP", "dV", "dC", "dE", "dK", "dL", "cB", "cH", "cD",
+    "cE", "fF", "fE", "fd", "fW", "fR", "fG", "fs", "D", "dO",
+    "pU", "dD", "dH", "dA", "aK",
+    "dM", 0
+};
+
 /*--------------------------------------------------------------------------*/
 /** @brief Initialise Global Configuration Variables
 
@@ -59,12 +76,45 @@ void set_global_defaults(void)
     configData.config.measurementSend = true;
     configData.config.debugMessageSend = false;
     configData.config.enableSend = true;
+    configData.config.overflowPolicy = OVERFLOW_DROP_OLDEST;
+    configData.config.consolidatedRecord = false;
+    uint8_t i, j;
+    for (i = 0; i < NUM_TRANSMIT_MAPS; i++)
+    {
+        configData.config.transmitMap[i].divider = 0;   /* all sent */
+        for (j = 0; j < TRANSMIT_MAP_ENTRIES; j++)
+            configData.config.transmitMap[i].entry[j] = 0;
+    }
 /* Set default recording control variables */
     configData.config.recording = false;
+    configData.config.binaryLog = false;
+    configData.config.syncBytes = SYNC_BYTES_DEFAULT;
+    configData.config.syncSeconds = SYNC_SECONDS_DEFAULT;
 /* Set default measurement variables */
     configData.config.measurementInterval = 1000;   /* 1 second intervals */
-    configData.config.numberConversions = 6;        /* number of interfaces plus temperature */
-    configData.config.numberSamples = 16;           /* burst of samples for averaging */
+    configData.config.interfaceEnable = 0x3F;       /* all interfaces */
+    configData.config.numberSamples = 16;           /* scans per DMA block */
+    configData.config.sampleRate = 0;               /* free running A/D */
+    for (i = 0; i < NUM_FILTER_GROUPS; i++)
+    {
+        configData.config.filterOrder[i] = 3;       /* third order CIC */
+        configData.config.decimationShift[i] = 4;   /* decimate by 16 */
+    }
+/* Set default transient capture variables */
+    configData.config.captureChannel = 0;           /* device 1 current */
+    configData.config.captureThreshold = 2500;
+    configData.config.captureRising = true;
+    configData.config.capturePreTrigger = 32;
+    configData.config.capturePostTrigger = 96;
+    configData.config.captureOutput = 0x03;         /* send and record */
+/* Set default calibration, with offsets to 4 fractional bits */
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        configData.config.currentOffset[i] = CURRENT_OFFSET*16;
+        configData.config.currentScale[i] = CURRENT_SCALE;
+        configData.config.voltageOffset[i] = VOLTAGE_OFFSET;
+        configData.config.voltageScale[i] = VOLTAGE_SCALE;
+    }
 }
 
 /*--------------------------------------------------------------------------*/
@@ -107,7 +157,9 @@ bit  1   if recording,
 bit  2
 bit  3   if measurements are being sent
 bit  4   if debug messages are being sent
-bits 5-15
+bit  5   if consolidated records are sent
+bit  6   if recording to a binary log
+bits 7-15
 
 @returns uint16_t status of controls
 */
@@ -117,6 +169,8 @@ uint16_t get_controls(void)
     if (configData.config.recording) controls |= 1<<1;
     if (configData.config.measurementSend) controls |= 1<<3;
     if (configData.config.debugMessageSend) controls |= 1<<4;
+    if (configData.config.consolidatedRecord) controls |= 1<<5;
+    if (configData.config.binaryLog) controls |= 1<<6;
     return controls;
 }
 
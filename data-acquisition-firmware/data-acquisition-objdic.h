@@ -28,7 +28,9 @@ tasks running on the same microcontroller.
 #define FIRMWARE_VERSION    "1.00"
 
 /*--------------------------------------------------------------------------*/
-/* Calibration factors to convert A/D measurements to physical entities. */
+/* Default calibration factors to convert A/D measurements to physical
+entities. The calibration used is held for each interface in the configuration
+block. */
 
 /* For current the scaling factor gives a value in 1/256 Amp precision.
 Subtract this from the measured value and scale by this factor.
@@ -93,12 +95,36 @@ Offset is 2.732V at 0 degrees C over 3.280 times 4096. */
 #define TEMPERATURE_SCALE   328*256
 #define TEMPERATURE_OFFSET  3412
 
+/*--------------------------------------------------------------------------*/
+/* Channel groups having separate decimation filter settings. */
+
+#define FILTER_GROUP_CURRENT        0
+#define FILTER_GROUP_VOLTAGE        1
+#define FILTER_GROUP_TEMPERATURE    2
+#define NUM_FILTER_GROUPS           3
+
+/*--------------------------------------------------------------------------*/
+/* Transmit maps, after the CANopen TxPDO mapping. Each map lists the object
+indices of interval telemetry messages sent together every divider measurement
+intervals. Unmapped telemetry is then not sent, but is still recorded. If no map
+is enabled all telemetry is sent every interval. */
+
+#define NUM_TRANSMIT_MAPS           4
+#define TRANSMIT_MAP_ENTRIES        8
+
+struct TransmitMap
+{
+    uint16_t divider;           /* Intervals between transmissions, 0 = off */
+    uint8_t entry[TRANSMIT_MAP_ENTRIES];    /* Object indices, 0 = unused */
+};
+
 /*--------------------------------------------------------------------------*/
 /****** Object Dictionary Items *******/
 /* Configuration items, updated externally, are stored to NVM */
 /* Values must be initialized in set_global_defaults(). */
 
 /*--------------------------------------------------------------------------*/
+/* Change VALID_BLOCK whenever this layout changes */
 struct Config
 {
 /* Valid data block indicator */
@@ -107,12 +133,33 @@ struct Config
     bool enableSend;            /* Any communications transmission occurs */
     bool measurementSend;       /* Measurements are transmitted */
     bool debugMessageSend;      /* Debug messages are transmitted */
+    uint8_t overflowPolicy;     /* Send buffer overflow policy */
+    bool consolidatedRecord;    /* One record per measurement interval */
+    struct TransmitMap transmitMap[NUM_TRANSMIT_MAPS];
 /* Recording Control Variables */
     bool recording;             /* Recording of performance data */
+    bool binaryLog;             /* Recorded as binary records, not lines */
+    uint16_t syncBytes;         /* Bytes written between file syncs */
+    uint16_t syncSeconds;       /* Longest time written data is held back */
 /* Measurement Variables */
     uint32_t measurementInterval;   /* Time between measurements */
-    uint8_t numberConversions;  /* Number of channels to be converted */
-    uint8_t numberSamples;      /* Number of samples for averaging */
+    uint8_t interfaceEnable;    /* Bit map of interfaces converted and sent */
+    uint8_t numberSamples;      /* Number of A/D scans in each DMA block */
+    uint16_t sampleRate;        /* A/D scans per second, 0 = free running */
+    uint8_t filterOrder[NUM_FILTER_GROUPS];     /* CIC filter order 1-4 */
+    uint8_t decimationShift[NUM_FILTER_GROUPS]; /* Decimation ratio power of 2 */
+/* Transient Capture Variables */
+    uint8_t captureChannel;     /* Channel tested for the level trigger */
+    uint16_t captureThreshold;  /* A/D level for the trigger */
+    bool captureRising;         /* Trigger on a rising rather than falling level */
+    uint16_t capturePreTrigger; /* Scans kept before the trigger */
+    uint16_t capturePostTrigger;/* Scans kept from the trigger */
+    uint8_t captureOutput;      /* Bit 0 send, bit 1 record the capture */
+/* Calibration Variables, as for the default factors above */
+    uint16_t currentOffset[NUM_INTERFACES]; /* A/D value at zero times 16 */
+    uint16_t currentScale[NUM_INTERFACES];  /* Amperes times 256 full scale */
+    int32_t voltageOffset[NUM_INTERFACES];  /* Volts times 2^20 at zero A/D */
+    uint16_t voltageScale[NUM_INTERFACES];  /* Volts times 256 full scale */
 };
 
 /* Map the configuration data also as a block of words.
@@ -125,6 +172,9 @@ union ConfigGroup
     struct Config config;
 };
 
+/* Message idents indexed for binary frames, terminated by a null entry. */
+extern const char* const telemetryIndex[];
+
 /*--------------------------------------------------------------------------*/
 /* Prototypes */
 /*--------------------------------------------------------------------------*/
@@ -50,13 +50,39 @@ Initial 23 November 2016
 #include "../libs/stringlib.h"
 #include "../libs/file.h"
 #include "../libs/timelib.h"
+#include "../libs/statistics.h"
+#include "../libs/decimation.h"
+#include "../libs/capture.h"
 #include "data-acquisition.h"
 #include "data-acquisition-objdic.h"
+#include "diskio.h"
 
 #include <stdbool.h>
 
 /* Local Prototypes */
-static void parseCommand(uint8_t* line);
+static void execute_command(uint8_t* line, bool damaged);
+static bool parseCommand(uint8_t* line);
+static int32_t channel_value(uint8_t channel, uint16_t code);
+static uint32_t scale_variance(uint32_t variance, uint32_t scale);
+static void set_calibration(void);
+static void set_scan_time(void);
+static void update_totals(void);
+static void set_filters(void);
+static void send_totals(void);
+static void record_line(uint8_t* data, uint16_t length);
+static void send_record(int16_t temperature, uint8_t interfaceEnable);
+static void build_record(int32_t* record, int16_t temperature,
+                         uint8_t interfaceEnable);
+static void record_log_header(void);
+static uint16_t put_word(uint8_t* data, uint16_t offset, uint32_t value,
+                         uint8_t size);
+static uint64_t transmit_due(void);
+static void set_acquisition_interfaces(void);
+static bool arm_capture(uint8_t trigger);
+static void disarm_capture(void);
+static void send_capture(void);
+static void set_cutoff(void);
+static void send_cutoff(void);
 
 /* Globals */
 static uint8_t writeFileHandle;
@@ -75,7 +101,52 @@ static uint8_t setting;
 static bool testRunning;
 static bool testStarted;
 static int32_t current[NUM_INTERFACES];
-static uint64_t voltage[NUM_INTERFACES];
+static uint32_t voltage[NUM_INTERFACES];
+static uint8_t activeInterface[NUM_INTERFACES];    /* Interfaces in scan order */
+static uint8_t numberActive;                       /* Interfaces in the scan */
+static struct Decimator adcFilters[NUM_CHANNEL];   /* A/D decimation filters */
+static struct Statistics adcStats[NUM_CHANNEL];    /* Accumulated A/D values */
+static int64_t chargeSum[NUM_INTERFACES];   /* Current A/D sums since update */
+static int64_t energySum[NUM_INTERFACES];   /* Power A/D sums since update */
+static int64_t charge[NUM_INTERFACES];      /* Charge in coulombs times 2^20 */
+static int64_t energy[NUM_INTERFACES];      /* Energy in joules times 2^20 */
+static uint64_t scanTime;                   /* Scan period in seconds times 2^40 */
+static uint8_t autoZero;                    /* Interfaces to be zeroed */
+static uint16_t captureIndex;               /* Next capture scan to send */
+static uint16_t captureChecksum;            /* Sum of the capture scans sent */
+static uint32_t intervalCount;              /* Measurement intervals elapsed */
+
+/* Conversion of a filtered A/D value to a physical value is a multiply by the
+scale with the offset added, then a shift down by 16 bits. */
+struct Calibration
+{
+    int32_t scale;
+    int64_t offset;
+};
+static struct Calibration calibration[NUM_CHANNEL];
+
+/* Cutoff of a test run by the A/D watchdog */
+static volatile bool cutoffPending;
+static volatile bool powerFailPending;  /* Supply is failing */
+static uint32_t cutoffSeconds;
+static uint16_t cutoffMilliseconds;
+static uint16_t cutoffValue;        /* A/D value that tripped the cutoff */
+
+/* Serial baud rate changes awaiting confirmation */
+static uint32_t baudrate;
+static uint32_t previousBaudrate;
+static volatile uint8_t baudrateTimer;  /* Ticks left to confirm a change */
+static volatile bool baudrateRevert;    /* Change not confirmed in time */
+static const uint32_t baudrates[] =
+    {38400, 57600, 115200, 230400, 460800, 921600, 0};
+
+/* A/D channels for the current and voltage of each interface */
+static const uint8_t currentChannel[NUM_INTERFACES] =
+    {ADC_CHANNEL_0, ADC_CHANNEL_2, ADC_CHANNEL_4,
+     ADC_CHANNEL_6, ADC_CHANNEL_8, ADC_CHANNEL_10};
+static const uint8_t voltageChannel[NUM_INTERFACES] =
+    {ADC_CHANNEL_1, ADC_CHANNEL_3, ADC_CHANNEL_5,
+     ADC_CHANNEL_7, ADC_CHANNEL_9, ADC_CHANNEL_11};
 
 /* These configuration variables are part of the Object Dictionary. */
 /* This is defined in data-acquisition-objdic and is updated in response to
@@ -89,29 +160,34 @@ int main(void)
     set_global_defaults();
     hardware_init();
     init_comms_buffers();
+    comms_set_record_sink(record_line);
+    comms_set_overflow_policy(configData.config.overflowPolicy);
 
-    uint8_t channel_array[NUM_CHANNEL];
-    channel_array[0] = ADC_CHANNEL_0;
-    channel_array[1] = ADC_CHANNEL_1;
-    channel_array[2] = ADC_CHANNEL_2;
-    channel_array[3] = ADC_CHANNEL_3;
-    channel_array[4] = ADC_CHANNEL_4;
-    channel_array[5] = ADC_CHANNEL_5;
-    channel_array[6] = ADC_CHANNEL_6;
-    channel_array[7] = ADC_CHANNEL_7;
-    channel_array[8] = ADC_CHANNEL_8;
-    channel_array[9] = ADC_CHANNEL_9;
-    channel_array[10] = ADC_CHANNEL_10;
-    channel_array[11] = ADC_CHANNEL_11;
-    channel_array[12] = ADC_CHANNEL_TEMPERATURE;
-    set_adc_channel_sequence(0, NUM_CHANNEL, channel_array);
+    set_adc_block_size(configData.config.numberSamples);
 
     uint16_t i = 0;
-    uint32_t avg[NUM_CHANNEL];
+    set_calibration();
+    autoZero = 0;
+    for (i = 0; i < NUM_CHANNEL; i++) stats_clear(&adcStats[i], 0x8000);
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        chargeSum[i] = 0;
+        energySum[i] = 0;
+        charge[i] = 0;
+        energy[i] = 0;
+    }
+    cutoffPending = false;
+    powerFailPending = false;
+    set_acquisition_interfaces();
+
+    baudrate = BAUDRATE_DEFAULT;
+    baudrateTimer = 0;
+    baudrateRevert = false;
 
     set_delay_count(configData.config.measurementInterval);
 
     init_file_system();
+    set_sync_policy(configData.config.syncBytes, configData.config.syncSeconds);
     writeFileHandle = 0xFF;
     readFileHandle = 0xFF;
     writeFileName[0] = 0;
@@ -119,6 +195,7 @@ int main(void)
 
     interface = 0;
     resetTimer = 0;
+    intervalCount = 0;
 
     testType = 0;
     voltageLimit = 0;
@@ -135,94 +212,254 @@ int main(void)
 	{
 /* -------- CLI ------------*/
 /* Command Line Interface receiver interpretation.
- Process incoming commands as they appear on the serial input.*/
+ Process incoming commands as they appear on the serial input. All characters
+ waiting are taken on each pass so that the receive buffer keeps up with the
+ link. Lines that overflow, or that may have lost characters, are noted as
+ damaged for sequenced commands.*/
         static uint8_t line[80];
         static uint8_t characterPosition = 0;
-        if (receive_data_available())
+        static bool lineOverflow = false;
+        while (receive_data_available())
         {
             uint8_t character = get_from_receive_buffer();
             if ((character == 0x0D) || (character == 0x0A) || (characterPosition > 78))
             {
+                if (characterPosition > 78) lineOverflow = true;
                 line[characterPosition] = 0;
                 characterPosition = 0;
-                parseCommand(line);
+                bool damaged = comms_receive_overflow() || lineOverflow;
+                if ((character == 0x0D) || (character == 0x0A)) lineOverflow = false;
+                execute_command(line, damaged);
             }
             else line[characterPosition++] = character;
         }
         if (get_delay_count() > 0xFFFFFF) set_delay_count(configData.config.measurementInterval);
 
+/* -------- Baud Rate Revert --------- */
+/* Restore the previous baud rate if a change was not confirmed. */
+        if (baudrateRevert)
+        {
+            baudrateRevert = false;
+            baudrate = previousBaudrate;
+            usart1_set_baudrate(baudrate);
+            data_message_send("pU",baudrate,2);
+        }
+
+/* -------- Test Cutoff --------- */
+/* Report a test run cut off by the A/D watchdog. */
+        if (cutoffPending) send_cutoff();
+
+/* -------- File Sync --------- */
+/* Write out recorded data held back too long, or all of it if power is failing. */
+        if (powerFailPending)
+        {
+            powerFailPending = false;
+            sync_file(writeFileHandle);
+        }
+        sync_file_poll();
+/* Move on any SD card write running in the background once the card is ready. */
+        disk_poll();
+
+/* -------- Charge and Energy Totals --------- */
+/* Fold the scan sums into the totals each second whatever the measurement
+interval, as the power sums can overflow within minutes at the fastest scan
+rates. */
+        static uint32_t totalsSeconds = 0;
+        if (get_seconds_count() != totalsSeconds)
+        {
+            totalsSeconds = get_seconds_count();
+            update_totals();
+        }
+
+/* -------- Transient Capture --------- */
+/* Send out a completed capture a scan at a time. */
+        if (capture_status() == CAPTURE_COMPLETE) send_capture();
+
 /* -------- Measurements --------- */
         if (get_delay_count() == 0)
         {
 
-/* Clear stats and setup array of selected channels for conversion */
+/* Take the statistics accumulated from the A/D blocks over the interval, and
+clear for the next interval using the mean as the new reference. The ISR is
+held off while this is done. */
             uint8_t i = 0;
+            struct Statistics stats[NUM_CHANNEL];
+            cli();
 	        for (i = 0; i < NUM_CHANNEL; i++)
 	        {
-                avg[i] = 0;
+                stats[i] = adcStats[i];
+                stats_clear(&adcStats[i], stats_mean(&stats[i]));
 	        }
-/* Run a burst of samples and average */
-            uint8_t sample = 0;
-            uint8_t numSamples = configData.config.numberSamples;
-            if (numSamples < 1) numSamples = 1;
-            for (sample = 0; sample < numSamples; sample++)
-            {
-/* Start conversion and wait for conversion end. */
-                start_adc_conversion(0);
-                while (! adc_eoc_is_set()) {}
-                for (i = 0; i < NUM_CHANNEL; i++)
-	            {
-                    avg[i] += adc_value(i);
-	            }
-            }
-            int16_t temperature = ((avg[12]/numSamples-TEMPERATURE_OFFSET)
-                                        *TEMPERATURE_SCALE)/4096;
-            uint8_t numInterfaces = configData.config.numberConversions-1;
-            if (numInterfaces > NUM_INTERFACES) numInterfaces = NUM_INTERFACES;
-            for (i=0; i < numInterfaces; i++)
+            sei();
+            uint8_t interfaceEnable = configData.config.interfaceEnable;
+/* Zero the current offsets if requested, using the mean current over the
+interval. */
+            if (autoZero != 0)
+            {
+                for (i=0; i < NUM_INTERFACES; i++)
+                {
+                    if (((interfaceEnable & autoZero & (1 << i)) != 0)
+                        && (stats[i+i].count > 0))
+                        configData.config.currentOffset[i] = stats_mean(&stats[i+i]);
+                }
+                autoZero = 0;
+                set_calibration();
+            }
+            struct Statistics* temperatureStats = &stats[NUM_CHANNEL-1];
+            int16_t temperature = channel_value(NUM_CHANNEL-1,
+                                                stats_mean(temperatureStats));
+            for (i=0; i < NUM_INTERFACES; i++)
             {
+                if ((interfaceEnable & (1 << i)) == 0) continue;
                 uint8_t k = i+i;
-                current[i] = ((avg[k]/numSamples-CURRENT_OFFSET)*CURRENT_SCALE)/4096;
-                voltage[i] = (avg[k+1]/numSamples*VOLTAGE_SCALE+VOLTAGE_OFFSET)/4096;
+                current[i] = channel_value(k, stats_mean(&stats[k]));
+                voltage[i] = channel_value(k+1, stats_mean(&stats[k+1]));
             }
+            update_totals();
 /* ------------- Transmit and save to file -----------*/
-/* Send out a time string */
-            char timeString[20];
-            put_time_to_string(timeString);
-            send_string("pH",timeString);
-            if (is_recording()) record_string("pH",timeString,writeFileHandle);
-/* Send out temperature measurement. */
-            send_response("dT",temperature);
-            if (is_recording()) record_single("dT",temperature,writeFileHandle);
-/* Send off accumulated data as dBx where x is 0-5 for devices 1-3, loads 1-2,
-source. */
-            char id[4];
-            id[0] = 'd';
-            id[1] = 'B';
-            id[3] = 0;
-            for (i=0; i < numInterfaces; i++)
+/* Send out one consolidated record, or separate messages for each quantity.
+Each message is formatted once and the same line is recorded if a file is open.
+Only the messages due under the transmit maps are sent. A binary log takes the
+consolidated record instead. */
+            bool binaryLog = is_recording() && configData.config.binaryLog;
+            uint8_t outputs = OUTPUT_SEND;
+            if (is_recording() && ! binaryLog) outputs |= OUTPUT_RECORD;
+            comms_set_output(outputs);
+            comms_telemetry_start();
+            comms_set_telemetry_due(transmit_due());
+            intervalCount++;
+            if (configData.config.consolidatedRecord)
+                send_record(temperature, interfaceEnable);
+            else
             {
-                id[2] = '1'+i;
-                data_message_send(id, current[i], voltage[i]);
-                if (is_recording()) record_dual(id, current[i], voltage[i], writeFileHandle);
-            }
+/* Send out a time string, or the time in seconds if delta compressed in which
+case the time string is still recorded. */
+                char timeString[20];
+                put_time_to_string(timeString);
+                if (comms_delta_frames())
+                {
+                    comms_set_output(OUTPUT_SEND);
+                    send_response("dH",get_seconds_count());
+                    comms_set_output(outputs & OUTPUT_RECORD);
+                    send_string("pH",timeString);
+                    comms_set_output(outputs);
+                }
+                else send_string("pH",timeString);
+/* Send out temperature measurement, followed by its minimum, maximum and
+variance over the interval. */
+                int32_t params[8];
+                params[0] = temperature;
+                params[1] = channel_value(NUM_CHANNEL-1, temperatureStats->minimum);
+                params[2] = channel_value(NUM_CHANNEL-1, temperatureStats->maximum);
+                params[3] = scale_variance(stats_variance(temperatureStats),
+                                           calibration[NUM_CHANNEL-1].scale);
+                send_response("dT",temperature);
+                data_list_send("dt",params+1,3);
+/* Send off accumulated data as dBx where x is 0-5 for devices 1-3, loads 1-2,
+source. The current and voltage minimum, maximum and variance over the interval
+follow as dIx. */
+                char id[4];
+                id[0] = 'd';
+                id[3] = 0;
+                for (i=0; i < NUM_INTERFACES; i++)
+                {
+                    if ((interfaceEnable & (1 << i)) == 0) continue;
+                    uint8_t k = i+i;
+                    id[2] = '1'+i;
+                    params[0] = current[i];
+                    params[1] = voltage[i];
+                    params[2] = channel_value(k, stats[k].minimum);
+                    params[3] = channel_value(k, stats[k].maximum);
+                    params[4] = scale_variance(stats_variance(&stats[k]),
+                                               calibration[k].scale);
+                    params[5] = channel_value(k+1, stats[k+1].minimum);
+                    params[6] = channel_value(k+1, stats[k+1].maximum);
+                    params[7] = scale_variance(stats_variance(&stats[k+1]),
+                                               calibration[k+1].scale);
+                    id[1] = 'B';
+                    data_message_send(id, current[i], voltage[i]);
+                    id[1] = 'I';
+                    data_list_send(id, params+2, 6);
+                }
+/* Send out the charge and energy totals. */
+                send_totals();
 /* Send out switch status */
-            send_response("ds",(int)get_switch_control_bits());
-            if (is_recording()) record_single("ds",(int)get_switch_control_bits(),writeFileHandle);
+                send_response("ds",(int)get_switch_control_bits());
 /* Send out running test information. This is always sent during a test run even
 if no time limit has been set to indicate an active test run. */
-            if (testStarted)
+                if (testStarted)
+                {
+                    send_response("dR",runtimeElapsed);
+                    send_response("dr",secondsElapsed);
+                }
+                send_response("dX",testRunning);
+            }
+            comms_telemetry_end();
+            comms_set_output(OUTPUT_SEND);
+            if (binaryLog)
             {
-                send_response("dR",runtimeElapsed);
-                send_response("dr",secondsElapsed);
+                int32_t record[RECORD_FIELDS];
+                build_record(record, temperature, interfaceEnable);
+                write_log_record(writeFileHandle, (uint8_t*)record, sizeof(record));
             }
-            send_response("dX",testRunning);
         }
 	}
 
 	return 0;
 }
 
+/*--------------------------------------------------------------------------*/
+/** @brief Execute a command line, acknowledging sequenced commands.
+
+A command may be prefixed by #n where n is a sequence number 0-255. It is then
+acknowledged with aK,n,1 once acted on, or aK,n,0 if it was damaged in
+reception or not recognized, so that the sender can have several commands in
+flight and resend any that fail. A command already accepted is acknowledged
+again but not repeated, in case the acknowledgement was lost. A # alone clears
+the record of accepted commands, for a sender starting a new sequence.
+
+Commands without a sequence number are acted on as before.
+
+@param[in] line: uint8_t* pointer to the command line in ASCII
+@param[in] damaged: bool true if the line may have lost characters.
+*/
+
+static void execute_command(uint8_t* line, bool damaged)
+{
+    static uint8_t acceptedSequence[32];    /* Bit map of accepted commands */
+    if (line[0] != '#')
+    {
+        parseCommand(line);
+        return;
+    }
+    uint8_t i = 1;
+    uint16_t sequence = 0;
+    while ((line[i] >= '0') && (line[i] <= '9') && (i < 4))
+        sequence = sequence*10 + line[i++] - '0';
+    if (i == 1)
+    {
+        if (line[1] == 0)
+            for (i = 0; i < 32; i++) acceptedSequence[i] = 0;
+        return;
+    }
+    if (damaged || (sequence > 255))
+    {
+        if (sequence <= 255) data_message_send("aK",sequence,0);
+        return;
+    }
+    uint8_t bit = 1 << (sequence & 0x07);
+    bool accepted = ((acceptedSequence[sequence >> 3] & bit) != 0);
+    if (! accepted) accepted = parseCommand(line+i);
+    if (accepted)
+    {
+/* Forget the sequence number half way round so that it can be reused. */
+        uint8_t stale = (sequence + 128) & 0xFF;
+        acceptedSequence[stale >> 3] &= ~(1 << (stale & 0x07));
+        acceptedSequence[sequence >> 3] |= bit;
+    }
+    data_message_send("aK",sequence,accepted);
+}
+
 /*--------------------------------------------------------------------------*/
 /** @brief Parse a command line and act on it.
 
@@ -234,10 +471,12 @@ in total).
 Unrecognizable messages are just discarded.
 
 @param[in] line: uint8_t* pointer to the command line in ASCII
+@returns bool: true if the command was recognized.
 */
 
-void parseCommand(uint8_t* line)
+bool parseCommand(uint8_t* line)
 {
+    bool recognized = true;
 /* ======================== Action commands ========================  */
 /**
 Action Commands */
@@ -254,7 +493,10 @@ load/panel). */
                 device = line[2]-'0';
                 setting = line[3]-'0'-1;
                 if ((device > 0) && (device <= NUM_DEVICES) && (setting < 3))
+                {
                     set_switch(device, setting);
+                    capture_event();
+                }
                 break;
             }
 /* Request preset test parameters to be sent back. */
@@ -273,6 +515,7 @@ load/panel). */
                     secondsElapsed = 0;
                     runtimeElapsed = 0;
                     testRunning = true;
+                    set_cutoff();
                 }
                 break;
             }
@@ -284,6 +527,8 @@ load/panel). */
                 {
                     set_switch(0, setting);
                 }
+                capture_event();
+                clear_adc_watchdog();
                 testRunning = false;
                 break;
             }
@@ -297,6 +542,7 @@ being device 1-3, loads 1-2 and source. */
                 if (interface > 0)
                 {
                     overcurrent_reset(interface);
+                    capture_event();
                     resetTimer = 25;        /* Set to 250 ms */
                 }
                 break;
@@ -307,6 +553,42 @@ being device 1-3, loads 1-2 and source. */
                 write_config_block();
                 break;
             }
+/* Qn Reset the charge and energy totals of an interface n=0-5 being devices
+1-3, loads 1-2 and source. All are reset if n is absent. */
+        case 'Q':
+            {
+                update_totals();
+                uint8_t i;
+                for (i=0; i < NUM_INTERFACES; i++)
+                {
+                    if ((line[2] == 0) || (line[2]-'0' == i))
+                    {
+                        charge[i] = 0;
+                        energy[i] = 0;
+                    }
+                }
+                break;
+            }
+/* Zn Zero the current offset of interface n=0-5 being devices 1-3, loads 1-2
+and source, or all interfaces if n is absent. The mean current over the next
+measurement interval is taken as the offset, so no current should be flowing. */
+        case 'Z':
+            {
+                if (line[2] == 0) autoZero = (1 << NUM_INTERFACES) - 1;
+                else if (line[2]-'0' < NUM_INTERFACES)
+                    autoZero |= 1 << (line[2]-'0');
+                break;
+            }
+/* Cn Transient capture. n = 1 arms the capture to trigger on the configured
+channel level, n = 2 arms it to trigger on a switch change or interface reset,
+and n = 0 disarms it. The completed capture is sent and/or recorded. */
+        case 'C':
+            {
+                uint8_t trigger = line[2]-'0';
+                if (trigger == 0) disarm_capture();
+                else if (! arm_capture(trigger)) send_response("dC",-1);
+                break;
+            }
 /* Request identification string with version sent back.  */
         case 'E':
             {
@@ -315,6 +597,8 @@ being device 1-3, loads 1-2 and source. */
                 send_string("dE",ident);
                 break;
             }
+        default:
+            recognized = false;
         }
     }
 /* ======================== Data request commands ================  */
@@ -332,7 +616,80 @@ Return the internal time.
                 char timeString[20];
                 put_time_to_string(timeString);
                 send_string("pH",timeString);
+                break;
+            }
+/**
+Return the calibration of each interface as dKx where x is 1-6 for devices
+1-3, loads 1-2 and source, with current offset, current scale, voltage offset
+and voltage scale.
+ */
+        case 'K':
+            {
+                char id[4] = "dK1";
+                int32_t params[4];
+                uint8_t i;
+                for (i=0; i < NUM_INTERFACES; i++)
+                {
+                    id[2] = '1'+i;
+                    params[0] = configData.config.currentOffset[i];
+                    params[1] = configData.config.currentScale[i];
+                    params[2] = configData.config.voltageOffset[i];
+                    params[3] = configData.config.voltageScale[i];
+                    data_list_send(id, params, 4);
+                }
+                break;
+            }
+/**
+Return the transmit maps as dMm where m is 1-4, with the divider and the object
+indices mapped.
+ */
+        case 'M':
+            {
+                char id[4] = "dM1";
+                int32_t params[TRANSMIT_MAP_ENTRIES+1];
+                uint8_t i, j;
+                for (i = 0; i < NUM_TRANSMIT_MAPS; i++)
+                {
+                    struct TransmitMap* map = &configData.config.transmitMap[i];
+                    id[2] = '1'+i;
+                    params[0] = map->divider;
+                    uint8_t number = 1;
+                    for (j = 0; j < TRANSMIT_MAP_ENTRIES; j++)
+                        if (map->entry[j] > 0) params[number++] = map->entry[j];
+                    data_list_send(id, params, number);
+                }
+                break;
+            }
+/**
+Return the transient capture state (0 idle, 1 armed, 2 triggered, 3 complete).
+ */
+        case 'C':
+            {
+                send_response("dC",capture_status());
+                break;
+            }
+/**
+Return the charge and energy totals for each interface.
+ */
+        case 'Q':
+            {
+                update_totals();
+                send_totals();
+                break;
+            }
+/**
+Return the send buffer counters: messages that overflowed the buffer, messages
+lost, and telemetry intervals skipped under the overflow policy.
+ */
+        case 'O':
+            {
+                int32_t counters[3];
+                comms_get_counters(counters);
+                data_list_send("dO",counters,3);
+                break;
             }
+        default:
+            recognized = false;
         }
     }
 /* ======================== Parameter commands ================  */
@@ -349,6 +706,26 @@ Parameter Setting Commands */
                 else if (line[2] == '+') configData.config.enableSend = true;
                 break;
             }
+/* B-, B+ Send messages as ASCII lines or as binary frames. The response is sent
+in binary when changing to and from binary frames.
+Bn Set the mode as 0 ASCII lines, 1 binary frames, or 2 binary frames with
+delta compressed interval telemetry. */
+        case 'B':
+            {
+                if ((line[2] == '+') || (line[2] == '1') || (line[2] == '2'))
+                {
+                    comms_set_binary_frames(true);
+                    comms_set_delta_frames(line[2] == '2');
+                    send_response("pB",(line[2] == '2') ? 2 : 1);
+                }
+                else if ((line[2] == '-') || (line[2] == '0'))
+                {
+                    send_response("pB",0);
+                    comms_set_binary_frames(false);
+                    comms_set_delta_frames(false);
+                }
+                break;
+            }
 /* d-, d+ Turn on debug messages */
         case 'd':
             {
@@ -369,12 +746,33 @@ Parameter Setting Commands */
                 else if (line[2] == '+') configData.config.measurementSend = true;
                 break;
             }
-/* r-, r+ Turn recording on or off */
+/* r-, r+ Turn recording on or off. A binary log is ended when recording stops. */
         case 'r':
             {
-                if (line[2] == '-') configData.config.recording = false;
+                if (line[2] == '-')
+                {
+                    if (is_recording() && configData.config.binaryLog)
+                        end_log(writeFileHandle);
+                    configData.config.recording = false;
+                }
                 else if ((line[2] == '+') && (writeFileHandle < 0x0FF))
+                {
                     configData.config.recording = true;
+                    if (configData.config.binaryLog) record_log_header();
+                }
+                break;
+            }
+/* L-, L+ Record to the file as ASCII lines or as a binary log of one fixed record
+per interval. A binary log starts with a header block, and is ended to a sector
+boundary before any ASCII lines follow. */
+        case 'L':
+            {
+                bool start = (line[2] == '+') && ! configData.config.binaryLog;
+                bool end = (line[2] == '-') && configData.config.binaryLog;
+                if (end && is_recording()) end_log(writeFileHandle);
+                if (line[2] == '-') configData.config.binaryLog = false;
+                else if (line[2] == '+') configData.config.binaryLog = true;
+                if (start && is_recording()) record_log_header();
                 break;
             }
 /* Tn Test run - Set Time limit n in seconds */
@@ -395,6 +793,172 @@ Parameter Setting Commands */
                 testType = line[2]-'0';
                 break;
             }
+/* Fgnk Set the decimation filter for channel group g (0 = currents,
+1 = voltages, 2 = temperature) to order n (1-4) and decimation ratio 2^k. */
+        case 'F':
+            {
+                uint8_t group = line[2]-'0';
+                if (group >= NUM_FILTER_GROUPS) break;
+                configData.config.filterOrder[group] = line[3]-'0';
+                configData.config.decimationShift[group] = ascii_to_int((char*)line+4);
+                set_filters();
+                break;
+            }
+/* Un Change the serial baud rate to n (38400, 57600, 115200, 230400, 460800 or
+921600). The response pU,n,0 is sent at the old rate before the change. The
+host must then send pU+ at the new rate within a second, answered by pU,n,1,
+otherwise the old rate is restored and pU,n,2 is sent at that rate. */
+        case 'U':
+            {
+                if (line[2] == '+')
+                {
+                    if (baudrateTimer > 0)
+                    {
+                        baudrateTimer = 0;
+                        data_message_send("pU",baudrate,1);
+                    }
+                    break;
+                }
+                uint32_t rate = ascii_to_int((char*)line+2);
+                uint8_t i = 0;
+                while ((baudrates[i] > 0) && (baudrates[i] != rate)) i++;
+                if ((baudrates[i] == 0) || (baudrateTimer > 0)) break;
+                data_message_send("pU",rate,0);
+                previousBaudrate = baudrate;
+                baudrate = rate;
+                usart1_set_baudrate(baudrate);
+                baudrateTimer = BAUDRATE_CONFIRM_TIME;
+                break;
+            }
+/* A-, A+ Send and record the measurements of each interval as separate messages
+or as one consolidated record. */
+        case 'A':
+            {
+                if (line[2] == '-') configData.config.consolidatedRecord = false;
+                else if (line[2] == '+') configData.config.consolidatedRecord = true;
+                break;
+            }
+/* Pm,d,i,... Set transmit map m (1-4) to send the interval telemetry with object
+indices i (up to 8, in order of the binary frame index from 1) every d
+measurement intervals. A divider of zero disables the map. While any map is
+enabled, telemetry not mapped is recorded but not sent. */
+        case 'P':
+            {
+                uint8_t m = line[2]-'1';
+                if ((m >= NUM_TRANSMIT_MAPS) || (line[3] != ',')) break;
+                struct TransmitMap* map = &configData.config.transmitMap[m];
+                char* field = (char*)line+4;
+                map->divider = ascii_to_int(field);
+                uint8_t j;
+                for (j = 0; j < TRANSMIT_MAP_ENTRIES; j++)
+                {
+                    while ((*field >= '0') && (*field <= '9')) field++;
+                    if (*field == ',') map->entry[j] = ascii_to_int(++field);
+                    else map->entry[j] = 0;
+                }
+                break;
+            }
+/* Ybn, Ytn Set the recording file sync policy, to sync after n bytes (b) or
+n seconds (t) of written data. Zero disables that limit. */
+        case 'Y':
+            {
+                uint16_t value = ascii_to_int((char*)line+3);
+                if (line[2] == 'b') configData.config.syncBytes = value;
+                else if (line[2] == 't') configData.config.syncSeconds = value;
+                set_sync_policy(configData.config.syncBytes,
+                                configData.config.syncSeconds);
+                break;
+            }
+/* On Set the send buffer overflow policy n (0 drop oldest messages,
+1 decimate telemetry, 2 pause telemetry until drained). */
+        case 'O':
+            {
+                uint8_t policy = line[2]-'0';
+                if (policy > OVERFLOW_PAUSE) break;
+                configData.config.overflowPolicy = policy;
+                comms_set_overflow_policy(policy);
+                break;
+            }
+/* Cxn Set transient capture parameter x to n. x = c trigger channel (0-11
+being interface current and voltage in turn, 12 temperature), t trigger level
+as an A/D value, e edge (+ rising, - falling), p scans before the trigger,
+m scans from the trigger, o output (bit 0 send, bit 1 record). */
+        case 'C':
+            {
+                int32_t value = ascii_to_int((char*)line+3);
+                switch (line[2])
+                {
+                case 'c':
+                    if (value < NUM_CHANNEL) configData.config.captureChannel = value;
+                    break;
+                case 't':
+                    configData.config.captureThreshold = value;
+                    break;
+                case 'e':
+                    configData.config.captureRising = (line[3] != '-');
+                    break;
+                case 'p':
+                    configData.config.capturePreTrigger = value;
+                    break;
+                case 'm':
+                    configData.config.capturePostTrigger = value;
+                    break;
+/* A capture being sent is started again on the new outputs */
+                case 'o':
+                    configData.config.captureOutput = value;
+                    captureIndex = 0;
+                    break;
+                }
+                break;
+            }
+/* Kxin Set calibration item x of interface i=0-5 to n. x = o current offset as
+an A/D value times 16, s current scale, O voltage offset, S voltage scale. See
+data-acquisition-objdic.h for the units. */
+        case 'K':
+            {
+                uint8_t i = line[3]-'0';
+                if (i >= NUM_INTERFACES) break;
+                int32_t value = ascii_to_int((char*)line+4);
+                switch (line[2])
+                {
+                case 'o':
+                    configData.config.currentOffset[i] = value;
+                    break;
+                case 's':
+                    configData.config.currentScale[i] = value;
+                    break;
+                case 'O':
+                    configData.config.voltageOffset[i] = value;
+                    break;
+                case 'S':
+                    configData.config.voltageScale[i] = value;
+                    break;
+                }
+                set_calibration();
+                break;
+            }
+/* In Set the interfaces to be converted and reported from a bit map n with bits
+0-5 being devices 1-3, loads 1-2 and source. */
+        case 'I':
+            {
+                configData.config.interfaceEnable =
+                    ascii_to_int((char*)line+2) & ((1 << NUM_INTERFACES) - 1);
+                set_acquisition_interfaces();
+                break;
+            }
+/* Sn Set the A/D scan rate n in scans per second. The scans are triggered by a
+hardware timer. Zero sets the ADC to free running continuous conversion. */
+        case 'S':
+            {
+                update_totals();
+                disarm_capture();
+                configData.config.sampleRate = ascii_to_int((char*)line+2);
+                set_adc_sample_rate(configData.config.sampleRate);
+                set_scan_time();
+                break;
+            }
+        default:
+            recognized = false;
         }
     }
 
@@ -409,6 +973,7 @@ Gxx         - Read a record from read or write file.
 Ddirname    - Get a directory listing. Directory name is 8.3 string style.
 d[dirname]  - Get the first (if dirname present) or next entry in directory.
 s           - Get status of open files and configData.config.recording flag
+c           - Get the recording counters
 M           - Mount the SD card.
 All commands return an error status byte at the end.
 Only one file for writing and a second for reading is possible.
@@ -459,16 +1024,26 @@ directory, then size and name are not sent back. The type character can be:
                 send_response("fE",(uint8_t)fileStatus);
                 break;
             }
-/* Wf Open a file f=filename for writing less than 12 characters.
-Parameter is a filename, 8 character plus dot plus 3 character extension.
+/* Wf[,k] Open a file f=filename for writing less than 12 characters.
+Parameter is a filename, 8 character plus dot plus 3 character extension,
+optionally followed by the space k in kilobytes to preallocate to a new file
+(default PREALLOCATE_DEFAULT, 0 for none).
 Returns a file handle. On error, file handle is 0xFF. */
             case 'W':
             {
                 if (! file_system_usable()) break;
+                uint32_t preallocate = PREALLOCATE_DEFAULT;
+                uint8_t i = 2;
+                while ((line[i] != 0) && (line[i] != ',')) i++;
+                if (line[i] == ',')
+                {
+                    line[i] = 0;
+                    preallocate = ascii_to_int((char*)line+i+1)*1024;
+                }
                 if (string_length((char*)line+2) < 12)
                 {
-                    uint8_t fileStatus =
-                        open_write_file((char*)line+2, &writeFileHandle);
+                    uint8_t fileStatus = open_write_file((char*)line+2,
+                                            &writeFileHandle, preallocate);
                     if (fileStatus == 0)
                     {
                         string_copy(writeFileName,(char*)line+2);
@@ -518,24 +1093,52 @@ files, with open write filehandle and filename first followed by read filehandle
 and filename, or blank if any file is not open. */
             case 's':
             {
-                comms_print_string("fs,");
-                comms_print_int((int)get_controls());
-                comms_print_string(",");
-                uint8_t writeStatus;
-                comms_print_int(writeFileHandle);
-                comms_print_string(",");
+                char status[48];
+                char number[12];
+                int_to_ascii((int)get_controls(),status);
+                string_append(status,",");
+                int_to_ascii(writeFileHandle,number);
+                string_append(status,number);
+                string_append(status,",");
                 if (writeFileHandle < 0xFF)
                 {
-                    comms_print_string(writeFileName);
-                    comms_print_string(",");
+                    string_append(status,writeFileName);
+                    string_append(status,",");
                 }
-                comms_print_int(readFileHandle);
+                int_to_ascii(readFileHandle,number);
+                string_append(status,number);
                 if (readFileHandle < 0xFF)
                 {
-                    comms_print_string(",");
-                    comms_print_string(readFileName);
+                    string_append(status,",");
+                    string_append(status,readFileName);
                 }
-                comms_print_string("\r\n");
+                send_string("fs",status);
+                break;
+            }
+/* c Return the recording counters: records written, whole sectors written and
+file syncs. */
+            case 'c':
+            {
+                uint32_t counters[3];
+                get_file_counters(counters);
+                data_list_send("fc",(int32_t*)counters,3);
+                break;
+            }
+/* l Return the binary log stream write times: number of multiple sector writes,
+and the total and longest time in milliseconds that they held up the program. */
+            case 'l':
+            {
+                uint32_t counters[3];
+                get_log_stream_counters(counters);
+                data_list_send("fl",(int32_t*)counters,3);
+                break;
+            }
+/* S Synchronize the write file, completing any binary log block in progress. */
+            case 'S':
+            {
+                if (! file_system_usable()) break;
+                uint8_t fileStatus = sync_file(writeFileHandle);
+                send_response("fE",(uint8_t)fileStatus);
                 break;
             }
 /* Cf Close File specified by f=file handle. */
@@ -571,15 +1174,633 @@ and filename, or blank if any file is not open. */
                 send_response("fE",(uint8_t)fileStatus);
                 break;
             }
+            default:
+                recognized = false;
+        }
+    }
+    else recognized = false;
+    return recognized;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Accumulate a block of A/D scans.
+
+The ADC converts continuously into a circular DMA buffer. As each half of the
+buffer is filled this is called from the DMA ISR with the completed block,
+while the other half is being filled. Each channel is passed through its
+decimation filter, and the filter outputs are accumulated over the measurement
+interval for the mean, variance, minimum and maximum of each channel.
+
+Each scan holds interleaved ADC1 and ADC2 results, giving the current and
+voltage of each enabled interface in turn followed by the temperature and a
+dummy.
+
+@param[in] samples: uint16_t* block of scans each of 2*(numberActive+1)
+conversions.
+@param[in] numberScans: uint8_t number of scans in the block.
+*/
+
+void acquisition_proc(uint16_t* samples, uint8_t numberScans)
+{
+    capture_add_block(samples, numberScans, 2*(numberActive+1));
+    uint8_t scan;
+    uint8_t j;
+    uint16_t output;
+    for (scan = 0; scan < numberScans; scan++)
+    {
+        for (j = 0; j < numberActive; j++)
+        {
+            uint8_t i = activeInterface[j];
+            uint8_t k = i+i;
+            uint16_t currentSample = samples[j+j];
+            uint16_t voltageSample = samples[j+j+1];
+            if (decimator_add(&adcFilters[k], currentSample, &output))
+                stats_add_sample(&adcStats[k], output);
+            if (decimator_add(&adcFilters[k+1], voltageSample, &output))
+                stats_add_sample(&adcStats[k+1], output);
+/* Integrate the current and power of each interface at every scan. The
+current is left as an A/D value times 16 and the voltage as volts times 2^20 to
+avoid a divide. */
+            int32_t current = ((int32_t)currentSample << 4)
+                                - configData.config.currentOffset[i];
+            int32_t voltage = voltageSample*configData.config.voltageScale[i]
+                                + configData.config.voltageOffset[i];
+            chargeSum[i] += current;
+            energySum[i] += (int64_t)current*voltage;
+        }
+        if (decimator_add(&adcFilters[NUM_CHANNEL-1], samples[j+j], &output))
+            stats_add_sample(&adcStats[NUM_CHANNEL-1], output);
+        samples += 2*(numberActive+1);
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief A/D Watchdog Cutoff
+
+This is called from the A/D watchdog ISR when the voltage of the device under
+test falls below the test voltage limit. The load is disconnected at once and
+the time and A/D value noted for reporting from the main loop.
+
+@param[in] value: uint16_t A/D value of the voltage that tripped the watchdog.
+*/
+
+void watchdog_proc(uint16_t value)
+{
+    if (! testRunning) return;
+    set_switch(0, setting);
+    testRunning = false;
+    capture_event();
+    cutoffMilliseconds = get_time_milliseconds(&cutoffSeconds);
+    cutoffValue = value;
+    cutoffPending = true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Power Fail Warning
+
+This is called from the PVD ISR when the supply falls below the warning level.
+The recording file is synchronized from the main loop.
+*/
+
+void power_fail_proc(void)
+{
+    powerFailPending = true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the Test Cutoff
+
+The ADC2 analog watchdog is set to trip when the voltage of the device under
+test falls below the voltage limit, giving a cutoff within one scan. The
+voltage limit is converted to an A/D value using the device calibration. If the
+device is not being converted, the once per second check of the averaged
+voltage in timer_proc() is relied on.
+*/
+
+static void set_cutoff(void)
+{
+    clear_adc_watchdog();
+    if ((device < 1) || (device > NUM_DEVICES)) return;
+    uint8_t i = device-1;
+    if ((configData.config.interfaceEnable & (1 << i)) == 0) return;
+    if (configData.config.voltageScale[i] == 0) return;
+    int64_t threshold = ((int64_t)voltageLimit << 12)
+                            - configData.config.voltageOffset[i];
+    threshold /= configData.config.voltageScale[i];
+    if (threshold < 0) threshold = 0;
+    if (threshold > 0xFFF) threshold = 0xFFF;
+    set_adc_watchdog(voltageChannel[i], threshold);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send the Test Cutoff
+
+The cutoff is sent and recorded as dL followed by the device number, the
+voltage in volts times 256, and the time to the millisecond.
+*/
+
+static void send_cutoff(void)
+{
+    char cutoffString[40];
+    char buffer[20];
+    cutoffPending = false;
+    int_to_ascii(device, cutoffString);
+    string_append(cutoffString, ",");
+    int_to_ascii(channel_value(2*device-1, cutoffValue << DECIMATION_FRACTION_BITS),
+                 buffer);
+    string_append(cutoffString, buffer);
+    string_append(cutoffString, ",");
+    put_seconds_to_string(cutoffSeconds, buffer);
+    string_append(cutoffString, buffer);
+    string_append(cutoffString, ".");
+    if (cutoffMilliseconds < 100) string_append(cutoffString, "0");
+    if (cutoffMilliseconds < 10) string_append(cutoffString, "0");
+    int_to_ascii(cutoffMilliseconds, buffer);
+    string_append(cutoffString, buffer);
+    if (is_recording()) comms_set_output(OUTPUT_SEND | OUTPUT_RECORD);
+    send_string("dL", cutoffString);
+    comms_set_output(OUTPUT_SEND);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the Interfaces to be Acquired
+
+The A/D scan is rebuilt to convert only the interfaces enabled in the
+configuration, followed by the temperature. Currents are converted on ADC1 and
+voltages on ADC2 at the same instant, with ADC2 making a dummy conversion while
+ADC1 converts the temperature. The DMA is reset to the new scan length, the
+filters are restarted and conversions resume at the configured scan rate.
+*/
+
+static void set_acquisition_interfaces(void)
+{
+    uint8_t current_array[ADC_SCAN_LENGTH];
+    uint8_t voltage_array[ADC_SCAN_LENGTH];
+    uint8_t active[NUM_INTERFACES];
+    uint8_t scanLength = 0;
+    uint8_t i;
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        if ((configData.config.interfaceEnable & (1 << i)) == 0) continue;
+        active[scanLength] = i;
+        current_array[scanLength] = currentChannel[i];
+        voltage_array[scanLength] = voltageChannel[i];
+        scanLength++;
+    }
+    current_array[scanLength] = ADC_CHANNEL_TEMPERATURE;
+    voltage_array[scanLength] = ADC_CHANNEL_1;
+    update_totals();
+    disarm_capture();
+    clear_adc_watchdog();
+    stop_adc_conversion();
+    set_adc_channel_sequence(1, scanLength+1, voltage_array);
+    set_adc_channel_sequence(0, scanLength+1, current_array);
+/* No blocks arrive from the DMA until conversions are restarted. */
+    for (i = 0; i < scanLength; i++) activeInterface[i] = active[i];
+    numberActive = scanLength;
+    set_filters();
+    set_adc_sample_rate(configData.config.sampleRate);
+    set_scan_time();
+    if (testRunning) set_cutoff();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Arm the Transient Capture
+
+The configured trigger channel is located in the scan, which holds the current
+and voltage of each enabled interface followed by the temperature. A level
+trigger cannot be armed on a channel that is not being converted.
+
+@param[in] trigger: uint8_t CAPTURE_TRIGGER_LEVEL or CAPTURE_TRIGGER_EVENT.
+@returns bool true if the capture was armed.
+*/
+
+static bool arm_capture(uint8_t trigger)
+{
+    if ((trigger != CAPTURE_TRIGGER_LEVEL) && (trigger != CAPTURE_TRIGGER_EVENT))
+        return false;
+    uint8_t channel = configData.config.captureChannel;
+    uint8_t position = 0xFF;
+    if (channel == NUM_CHANNEL-1) position = numberActive+numberActive;
+    else
+    {
+        uint8_t j;
+        for (j = 0; j < numberActive; j++)
+            if (activeInterface[j] == (channel >> 1))
+                position = j+j+(channel & 1);
+    }
+    if ((trigger == CAPTURE_TRIGGER_LEVEL) && (position == 0xFF)) return false;
+    captureIndex = 0;
+    return capture_arm(trigger, 2*(numberActive+1), position,
+                       configData.config.captureThreshold,
+                       configData.config.captureRising,
+                       configData.config.capturePreTrigger,
+                       configData.config.capturePostTrigger);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Disarm the Transient Capture
+
+Any capture being sent is abandoned, so that the next one is sent from its
+start.
+*/
+
+static void disarm_capture(void)
+{
+    capture_disarm();
+    captureIndex = 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send the Transient Capture
+
+A completed capture is sent and/or recorded as a framed block, one scan for
+each call so that the main loop is not held up. The frame starts with cB
+giving the enabled interface bit map, the number of scans before the trigger,
+the total number of scans and the scan period in processor clock cycles,
+followed by cH with the time. Each scan follows as cD with the raw A/D values
+in scan order. The frame ends with cE giving the number of scans and the
+16 bit sum of all values. The capture is then disarmed.
+
+When sent, the capture is paced to the serial link, as each scan waits for
+room in the send buffer.
+*/
+
+static void send_capture(void)
+{
+    bool sending = ((configData.config.captureOutput & 0x01) != 0);
+    bool recording = ((configData.config.captureOutput & 0x02) != 0)
+                     && is_recording();
+    uint8_t scanLength = 2*(numberActive+1);
+    int32_t params[2*ADC_SCAN_LENGTH];
+    uint16_t length = capture_length();
+    uint8_t i;
+/* Wait for the link to take the previous scan rather than lose scans. */
+    if (sending && (comms_send_space() < MESSAGE_SIZE)) return;
+    uint8_t outputs = 0;
+    if (sending) outputs |= OUTPUT_SEND;
+    if (recording) outputs |= OUTPUT_RECORD;
+    comms_set_output(outputs);
+    if (captureIndex == 0)
+    {
+        params[0] = configData.config.interfaceEnable;
+        params[1] = capture_pre_trigger();
+        params[2] = length;
+        params[3] = get_adc_scan_period();
+        char timeString[20];
+        put_time_to_string(timeString);
+        data_list_send("cB",params,4);
+        send_string("cH",timeString);
+        captureChecksum = 0;
+    }
+    if (captureIndex < length)
+    {
+        uint16_t* scan = capture_scan(captureIndex);
+        for (i = 0; i < scanLength; i++)
+        {
+            params[i] = scan[i];
+            captureChecksum += scan[i];
+        }
+        data_list_send("cD",params,scanLength);
+        captureIndex++;
+    }
+    if (captureIndex >= length)
+    {
+        data_message_send("cE",length,captureChecksum);
+        disarm_capture();
+    }
+    comms_set_output(OUTPUT_SEND);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the Decimation Filters
+
+Each channel filter is set to the order and decimation ratio configured for
+its channel group, and restarted. The ISR is held off while this is done.
+*/
+
+static void set_filters(void)
+{
+    uint8_t i;
+    cli();
+    for (i = 0; i < NUM_CHANNEL; i++)
+    {
+        uint8_t group = FILTER_GROUP_TEMPERATURE;
+        if (i < 2*NUM_INTERFACES)
+            group = (i & 1) ? FILTER_GROUP_VOLTAGE : FILTER_GROUP_CURRENT;
+        decimator_init(&adcFilters[i], configData.config.filterOrder[group],
+                       configData.config.decimationShift[group]);
+    }
+    sei();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Update the Charge and Energy Totals
+
+The A/D sums of current and power accumulated at each scan since the last
+update are converted to charge and energy using the scan period, and added to
+the totals. The scaling is done in stages by multiplies and shifts to keep
+within 64 bits. This is called every second from the main loop to avoid
+overflow, and must also be called before the scan rate is changed.
+*/
+
+static void update_totals(void)
+{
+    int64_t chargeSums[NUM_INTERFACES];
+    int64_t energySums[NUM_INTERFACES];
+    uint8_t i;
+    cli();
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        chargeSums[i] = chargeSum[i];
+        energySums[i] = energySum[i];
+        chargeSum[i] = 0;
+        energySum[i] = 0;
+    }
+    sei();
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        int64_t scale = configData.config.currentScale[i];
+/* Current in amperes is the A/D difference sum times the scale over 2^24, and
+the scan period in seconds is scanTime over 2^40. */
+        int64_t current = (chargeSums[i]*scale) >> 20;
+        charge[i] += (current*(int64_t)scanTime) >> 24;
+/* Power in watts has a further voltage scaling of 2^20. */
+        int64_t power = ((energySums[i] >> 24)*scale) >> 16;
+        energy[i] += (power*(int64_t)scanTime) >> 24;
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the Scan Time
+
+The scan period is held as a fixed point value in seconds for integration of
+charge and energy. This must be called whenever the scan rate changes.
+*/
+
+static void set_scan_time(void)
+{
+    scanTime = ((uint64_t)get_adc_scan_period() << 40)/PROCESSOR_CLOCK;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send the Charge and Energy Totals
+
+The totals are sent as dQx where x is 0-5 for devices 1-3, loads 1-2 and
+source, with charge in coulombs and energy in joules, and are recorded with
+the interval telemetry. Only enabled interfaces are sent.
+*/
+
+static void send_totals(void)
+{
+    char id[4];
+    id[0] = 'd';
+    id[1] = 'Q';
+    id[3] = 0;
+    uint8_t i;
+    for (i=0; i < NUM_INTERFACES; i++)
+    {
+        if ((configData.config.interfaceEnable & (1 << i)) == 0) continue;
+        id[2] = '1'+i;
+        int32_t chargeTotal = charge[i] >> 20;
+        int32_t energyTotal = energy[i] >> 20;
+        data_message_send(id, chargeTotal, energyTotal);
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Record a message line to the open write file
+
+This is the record sink of the communications, taking the same lines that are
+sent.
+
+@param[in] data: uint8_t* message line with its line ending.
+@param[in] length: uint16_t length of the line.
+*/
+
+static void record_line(uint8_t* data, uint16_t length)
+{
+    if (configData.config.binaryLog) return;
+    uint8_t blockLength = length;
+    write_to_file(writeFileHandle, &blockLength, data);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send and record the consolidated record of an interval
+
+All the measurements of the interval are sent as a single dA message with a
+fixed field order, and recorded the same way, in place of the separate pH, dT,
+dBx, ds, dR, dr and dX messages. The fields are the time in seconds, the enabled
+interface bit map, the temperature, the current and voltage of each of the six
+interfaces (zero if not enabled), the switch control bits, the test running
+status, and the test run and total elapsed times (zero if no test started).
+
+The interval statistics and totals are not sent. The totals remain available on
+request.
+
+@param[in] temperature: int16_t temperature measurement.
+@param[in] interfaceEnable: uint8_t bit map of interfaces measured.
+*/
+
+static void send_record(int16_t temperature, uint8_t interfaceEnable)
+{
+    int32_t record[RECORD_FIELDS];
+    build_record(record, temperature, interfaceEnable);
+    data_list_send("dA",record,RECORD_FIELDS);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Build the consolidated record of an interval
+
+@param[out] record: int32_t* array of RECORD_FIELDS to receive the record.
+@param[in] temperature: int16_t temperature measurement.
+@param[in] interfaceEnable: uint8_t bit map of interfaces measured.
+*/
+
+static void build_record(int32_t* record, int16_t temperature,
+                         uint8_t interfaceEnable)
+{
+    record[0] = get_seconds_count();
+    record[1] = interfaceEnable;
+    record[2] = temperature;
+    uint8_t i;
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        bool enabled = ((interfaceEnable & (1 << i)) != 0);
+        record[3+i+i] = enabled ? current[i] : 0;
+        record[4+i+i] = enabled ? (int32_t)voltage[i] : 0;
+    }
+    record[15] = get_switch_control_bits();
+    record[16] = testRunning;
+    record[17] = testStarted ? runtimeElapsed : 0;
+    record[18] = testStarted ? secondsElapsed : 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Write the header of a binary log
+
+The header describes the records that follow, all fields little-endian: the
+layout version, the number of fields, the record length, the start time in
+seconds, the measurement interval in milliseconds, the enabled interface bit
+map and a spare byte, then for each interface the current offset, current
+scale, voltage offset and voltage scale (2, 2, 4 and 2 bytes). The firmware
+identification and the field names, separated by commas, follow as zero
+terminated strings.
+
+Each record of the log is the consolidated record of an interval as RECORD_FIELDS
+32 bit integers.
+*/
+
+static void record_log_header(void)
+{
+    uint8_t header[256];
+    uint16_t length = 0;
+    length = put_word(header, length, LOG_FORMAT_VERSION, 1);
+    length = put_word(header, length, RECORD_FIELDS, 1);
+    length = put_word(header, length, RECORD_FIELDS*sizeof(int32_t), 2);
+    length = put_word(header, length, get_seconds_count(), 4);
+    length = put_word(header, length, configData.config.measurementInterval, 4);
+    length = put_word(header, length, configData.config.interfaceEnable, 1);
+    length = put_word(header, length, 0, 1);
+    uint8_t i;
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        length = put_word(header, length, configData.config.currentOffset[i], 2);
+        length = put_word(header, length, configData.config.currentScale[i], 2);
+        length = put_word(header, length, configData.config.voltageOffset[i], 4);
+        length = put_word(header, length, configData.config.voltageScale[i], 2);
+    }
+    char ident[35] = "Data Acquisition System,";
+    string_append(ident,FIRMWARE_VERSION);
+    string_copy((char*)header+length, ident);
+    length += string_length(ident) + 1;
+    string_copy((char*)header+length, RECORD_SCHEMA);
+    length += string_length(RECORD_SCHEMA) + 1;
+    write_log_header(writeFileHandle, header, length);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Put a little-endian word into a byte array
+
+@param[in] data: uint8_t* byte array.
+@param[in] offset: uint16_t position of the word.
+@param[in] value: uint32_t value to put.
+@param[in] size: uint8_t number of bytes of the word.
+@returns uint16_t: position following the word.
+*/
+
+static uint16_t put_word(uint8_t* data, uint16_t offset, uint32_t value,
+                         uint8_t size)
+{
+    uint8_t i;
+    for (i = 0; i < size; i++) data[offset++] = (value >> (8*i)) & 0xFF;
+    return offset;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Interval telemetry due under the transmit maps
+
+The object indices of each enabled map are due when the interval count is a
+multiple of its divider. The time of the interval is sent whenever anything
+else is due so that the receiver can place the values.
+
+@returns uint64_t: bit map with bit i-1 set for object index i due.
+*/
+
+static uint64_t transmit_due(void)
+{
+    uint64_t due = 0;
+    bool mapped = false;
+    uint8_t i, j;
+    for (i = 0; i < NUM_TRANSMIT_MAPS; i++)
+    {
+        struct TransmitMap* map = &configData.config.transmitMap[i];
+        if (map->divider == 0) continue;
+        mapped = true;
+        if ((intervalCount % map->divider) != 0) continue;
+        for (j = 0; j < TRANSMIT_MAP_ENTRIES; j++)
+        {
+            uint8_t index = map->entry[j];
+            if ((index > 0) && (index <= 64)) due |= (uint64_t)1 << (index-1);
         }
     }
+    if (! mapped) return TELEMETRY_DUE_ALL;
+    if (due != 0)
+    {
+        uint8_t subindex;
+        due |= (uint64_t)1 << (comms_object_index("pH", &subindex)-1);
+        due |= (uint64_t)1 << (comms_object_index("dH", &subindex)-1);
+    }
+    return due;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the Calibration Coefficients
+
+The coefficients for converting filtered A/D values to physical values are
+computed from the calibration in the configuration block. This must be called
+whenever the calibration is changed.
+*/
+
+static void set_calibration(void)
+{
+    uint8_t i;
+    for (i = 0; i < NUM_INTERFACES; i++)
+    {
+        struct Calibration* currentCalibration = &calibration[i+i];
+        struct Calibration* voltageCalibration = &calibration[i+i+1];
+        currentCalibration->scale = configData.config.currentScale[i];
+        currentCalibration->offset = -(int64_t)configData.config.currentOffset[i]
+                                        *configData.config.currentScale[i];
+        voltageCalibration->scale = configData.config.voltageScale[i];
+        voltageCalibration->offset = (int64_t)configData.config.voltageOffset[i]
+                                        << DECIMATION_FRACTION_BITS;
+    }
+    calibration[NUM_CHANNEL-1].scale = TEMPERATURE_SCALE;
+    calibration[NUM_CHANNEL-1].offset =
+        -((int64_t)TEMPERATURE_OFFSET << DECIMATION_FRACTION_BITS)*TEMPERATURE_SCALE;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Convert a Filtered A/D Value to a Physical Value
+
+Currents are in amperes, voltages in volts and temperature in degrees C, all
+times 256.
+
+@param[in] channel: uint8_t channel number, being the current and voltage of
+each interface in turn, followed by the temperature.
+@param[in] code: uint16_t filtered A/D value with 4 fractional bits.
+@returns int32_t physical value.
+*/
+
+static int32_t channel_value(uint8_t channel, uint16_t code)
+{
+    return ((int64_t)code*calibration[channel].scale
+            + calibration[channel].offset) >> 16;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Convert an A/D Variance to Physical Units
+
+The variance of the A/D values is scaled by the square of the calibration
+factor used for the measurement, which includes the division by 4096. The
+result is in the square of the units of that measurement (times 256 squared).
+
+@param[in] variance: uint32_t variance of A/D values with 8 fractional bits.
+@param[in] scale: uint32_t calibration scale factor.
+@returns uint32_t scaled variance.
+*/
+
+static uint32_t scale_variance(uint32_t variance, uint32_t scale)
+{
+    return (((((uint64_t)variance*scale) >> 16)*scale) >> 16);
 }
 
 /*--------------------------------------------------------------------------*/
 /** @brief Take certain timed actions.
 
-These are hardware reset, and timed test runs, both of which are one-shot
-timers.
+These are hardware reset, baud rate change confirmation, and timed test runs,
+all of which are one-shot timers.
 
 This is called every 10ms from the hardware timer ISR.
 */
@@ -587,10 +1808,13 @@ This is called every 10ms from the hardware timer ISR.
 void timer_proc(void)
 {
     static uint32_t secondsTimer = 0;
+/* Handle timer for confirmation of a baud rate change */
+    if ((baudrateTimer > 0) && (--baudrateTimer == 0)) baudrateRevert = true;
 /* Handle timer for over current reset release */
     if ((interface > 0) && (resetTimer-- == 0))
     {
         overcurrent_release(interface);
+        capture_event();
         interface = 0;
     }
 /* handle timer and voltage checks for test runs every second */
@@ -606,7 +1830,9 @@ void timer_proc(void)
                 || (voltage[device-1] < voltageLimit))
             {
                 testRunning = false;
+                clear_adc_watchdog();
                 set_switch(0, setting);
+                capture_event();
             }
         }
     }
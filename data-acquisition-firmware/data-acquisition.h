@@ -25,7 +25,21 @@ K. Sarkies, 9 December 2016
 
 #include <stdint.h>
 
+/* Time allowed for a baud rate change to be confirmed, in 10ms ticks */
+#define BAUDRATE_CONFIRM_TIME   100
+
+/* Fields in the consolidated record of an interval */
+#define RECORD_FIELDS           19
+#define RECORD_SCHEMA           "time,interfaces,temperature,I1,V1,I2,V2,I3,V3,"\
+                                "I4,V4,I5,V5,I6,V6,switches,running,runtime,elapsed"
+
+/* Version of the binary log header layout */
+#define LOG_FORMAT_VERSION      1
+
 void timer_proc(void);
+void acquisition_proc(uint16_t* samples, uint8_t numberScans);
+void watchdog_proc(uint16_t value);
+void power_fail_proc(void);
 
 #endif
 
@@ -28,8 +28,10 @@ This window provides overall configuration.
 
 #include "data-acquisition-main.h"
 #include "data-acquisition-configure.h"
+#include "data-acquisition-frame.h"
 #include <QApplication>
 #include <QString>
+#include <QRegExp>
 #include <QLabel>
 #include <QSpinBox>
 #include <QCloseEvent>
@@ -52,8 +54,10 @@ DataAcquisitionConfigGui::DataAcquisitionConfigGui(QSerialPort* p, QWidget* pare
 {
     socket = p;
     DataAcquisitionConfigUi.setupUi(this);
-/* Ask for identification */
+/* Ask for identification and the transmit maps */
     socket->write("dE\n\r");
+    socket->write("dM\n\r");
+    for (int i = 0; i < 4; i++) transmitMaps.append(QString());
 }
 
 DataAcquisitionConfigGui::~DataAcquisitionConfigGui()
@@ -101,6 +105,94 @@ void DataAcquisitionConfigGui::on_dataMessageCheckbox_clicked()
         socket->write("pM-\n\r");
 }
 
+//-----------------------------------------------------------------------------
+/** @brief Enable Consolidated Records
+
+The measurements of each interval are sent and recorded as one record.
+*/
+
+void DataAcquisitionConfigGui::on_consolidatedRecordCheckbox_clicked()
+{
+    if (DataAcquisitionConfigUi.consolidatedRecordCheckbox->isChecked())
+        socket->write("pA+\n\r");
+    else
+        socket->write("pA-\n\r");
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Enable Binary Frames
+
+Messages from the remote are sent as binary frames rather than ASCII lines.
+The main window detects the change and decodes the frames.
+*/
+
+void DataAcquisitionConfigGui::on_binaryFramesCheckbox_clicked()
+{
+    if (! DataAcquisitionConfigUi.binaryFramesCheckbox->isChecked())
+        socket->write("pB-\n\r");
+    else if (DataAcquisitionConfigUi.deltaFramesCheckbox->isChecked())
+        socket->write("pB2\n\r");
+    else
+        socket->write("pB+\n\r");
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Enable Delta Compressed Telemetry
+
+Interval telemetry is sent as one binary frame of differences from the previous
+interval. This applies only with binary frames.
+*/
+
+void DataAcquisitionConfigGui::on_deltaFramesCheckbox_clicked()
+{
+    if (DataAcquisitionConfigUi.binaryFramesCheckbox->isChecked())
+        on_binaryFramesCheckbox_clicked();
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Set a Transmit Map
+
+The mapped message idents are sent by the remote every divider measurement
+intervals. While any map is enabled the remaining interval telemetry is only
+recorded, so this subscribes to the messages wanted at the rates wanted.
+*/
+
+void DataAcquisitionConfigGui::on_transmitMapButton_clicked()
+{
+    QString command = QString("pP%1,%2")
+                .arg(DataAcquisitionConfigUi.transmitMapSpinBox->value())
+                .arg(DataAcquisitionConfigUi.transmitDividerSpinBox->value());
+    QStringList idents = DataAcquisitionConfigUi.transmitIdentsEdit->text()
+                .split(QRegExp("[\\s,]+"), QString::SkipEmptyParts);
+    for (int i = 0; i < idents.size(); i++)
+    {
+        int index = FrameDecoder::index(idents.at(i));
+        if (index == 0)
+        {
+            displayErrorMessage("Unknown ident " + idents.at(i));
+            return;
+        }
+        command += QString(",%1").arg(index);
+    }
+    socket->write(command.append("\n\r").toLatin1().constData());
+    socket->write("dM\n\r");
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Show the selected Transmit Map
+
+@param[in] map Transmit map number 1-4.
+*/
+
+void DataAcquisitionConfigGui::on_transmitMapSpinBox_valueChanged(int map)
+{
+    if ((map < 1) || (map > transmitMaps.size())) return;
+    QStringList fields = transmitMaps.at(map-1).split(" ", QString::SkipEmptyParts);
+    if (fields.isEmpty()) return;
+    DataAcquisitionConfigUi.transmitDividerSpinBox->setValue(fields.takeFirst().toInt());
+    DataAcquisitionConfigUi.transmitIdentsEdit->setText(fields.join(" "));
+}
+
 //-----------------------------------------------------------------------------
 /** @brief Send Echo Request
 
@@ -161,6 +253,30 @@ void DataAcquisitionConfigGui::onMessageReceived(const QString &response)
             DataAcquisitionConfigUi.time->setText(systemTime.time().toString("H.mm.ss"));
             break;
         }
+// Show whether binary frames are in use
+        case 'B':
+        {
+            if (size < 2) break;
+            DataAcquisitionConfigUi.binaryFramesCheckbox
+                ->setChecked(breakdown[1].toInt() > 0);
+            DataAcquisitionConfigUi.deltaFramesCheckbox
+                ->setChecked(breakdown[1].toInt() == 2);
+            break;
+        }
+// Transmit map dMm with the divider and the object indices mapped
+        case 'M':
+        {
+            if ((size < 2) || (breakdown[0].size() < 3)) break;
+            int map = breakdown[0].at(2).digitValue();
+            if ((map < 1) || (map > transmitMaps.size())) break;
+            QString entry = breakdown[1];
+            for (int i = 2; i < size; i++)
+                entry += " " + FrameDecoder::ident(breakdown[i].toInt(), 0);
+            transmitMaps[map-1] = entry;
+            if (map == DataAcquisitionConfigUi.transmitMapSpinBox->value())
+                on_transmitMapSpinBox_valueChanged(map);
+            break;
+        }
     }
 }
 
@@ -51,6 +51,11 @@ private slots:
     void on_timeSetButton_clicked();
     void on_debugMessageCheckbox_clicked();
     void on_dataMessageCheckbox_clicked();
+    void on_consolidatedRecordCheckbox_clicked();
+    void on_binaryFramesCheckbox_clicked();
+    void on_deltaFramesCheckbox_clicked();
+    void on_transmitMapButton_clicked();
+    void on_transmitMapSpinBox_valueChanged(int map);
     void on_echoTestButton_clicked();
     void onMessageReceived(const QString &text);
     void displayErrorMessage(const QString message);
@@ -59,5 +64,6 @@ private:
     Ui::DataAcquisitionConfigDialog DataAcquisitionConfigUi;
     QSerialPort *socket;           //!< Serial port object pointer
     QString errorMessage;
+    QStringList transmitMaps;      //!< Divider and idents of each map
 };
 #endif
@@ -0,0 +1,312 @@
+/*       Data Acquisition Binary Frame Decoder
+
+Binary frames carry the message ident as an object index and subindex, followed
+by a count and the parameters as little-endian 32 bit integers (or a string). A
+CRC-16 is appended and the frame is COBS encoded.
+
+Interval telemetry may be delta compressed into a single frame per interval,
+holding the differences of the values from those last sent as zig-zag variable
+length integers. Key frames carry the message layout, and each frame marks the
+messages of the layout present in its interval.
+
+@date 16 October 2026
+*/
+/****************************************************************************
+ *   Copyright (C) 2016 by Ken Sarkies                                      *
+ *   ksarkies@internode.on.net                                              *
+ *                                                                          *
+ *   This file is part of Data Acquisition Project                          *
+ *                                                                          *
+ *   Data Acquisition is free software; you can redistribute it and/or      *
+ *   modify it under the terms of the GNU General Public License as         *
+ *   published by the Free Software Foundation; either version 2 of the     *
+ *   License, or (at your option) any later version.                        *
+ *                                                                          *
+ *   Data Acquisition is distributed in the hope that it will be useful,    *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU General Public License for more details.                           *
+ *                                                                          *
+ *   You should have received a copy of the GNU General Public License      *
+ *   along with Data Acquisition if not, write to the                       *
+ *   Free Software Foundation, Inc.,                                        *
+ *   51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.              *
+ ***************************************************************************/
+
+#include "data-acquisition-frame.h"
+#include <QDateTime>
+#include <QDebug>
+
+/* Message idents in order of their object index in binary frames, from 1.
+This must match the list in the remote object dictionary. */
+#define NUMINDEX 36
+const char* telemetryIndex[NUMINDEX] =
+    {"pH","pB","dT","dt","dB","dI","dQ","ds","dR","dr",
+     "dX","dP","dV","dC","dE","dK","dL","cB","cH","cD",
+     "cE","fF","fE","fd","fW","fR","fG","fs","D","dO",
+     "pU","dD","dH","dA","aK","dM"};
+
+/*---------------------------------------------------------------------------*/
+/** Frame Decoder Constructor
+*/
+
+FrameDecoder::FrameDecoder()
+{
+    reset();
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Forget the delta compression state
+
+Delta frames are then discarded until the next key frame.
+*/
+
+void FrameDecoder::reset()
+{
+    layout.clear();
+    values.clear();
+    valid.clear();
+    sequence = 0;
+    synchronized = false;
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Decode a binary frame
+
+The frame is COBS decoded and its CRC-16 checked. The object index and subindex
+are converted back to the ident and the parameters to ASCII.
+
+@param[in] frame COBS encoded frame without its delimiter.
+@returns message lines, empty if the frame is in error.
+*/
+
+QStringList FrameDecoder::decode(const QByteArray frame)
+{
+    QStringList lines;
+    QByteArray payload;
+    int n = 0;
+    while (n < frame.size())
+    {
+        int code = (unsigned char)frame.at(n++);
+        for (int i = 1; (i < code) && (n < frame.size()); i++)
+            payload += frame.at(n++);
+        if ((code < 0xFF) && (n < frame.size())) payload += (char)0;
+    }
+    if (payload.size() < 5) return lines;
+    quint16 crc = 0xFFFF;
+    for (int i = 0; i < payload.size()-2; i++)
+    {
+        crc ^= (quint16)((unsigned char)payload.at(i)) << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+            else crc <<= 1;
+        }
+    }
+    quint16 frameCrc = (unsigned char)payload.at(payload.size()-2)
+                     | ((unsigned char)payload.at(payload.size()-1) << 8);
+    if (crc != frameCrc)
+    {
+        qDebug() << "Frame CRC error";
+        return lines;
+    }
+    int length = payload.size()-2;
+    int index = (unsigned char)payload.at(0);
+    if ((index > 0) && (index <= NUMINDEX) &&
+        (QString(telemetryIndex[index-1]) == "dD"))
+        return decodeDelta(payload, length);
+    QString name;
+    int position;
+    if (index == 0)
+    {
+        position = 1;
+        while ((position < length) && (payload.at(position) != 0))
+            name += payload.at(position++);
+        position++;
+    }
+    else if (index <= NUMINDEX)
+    {
+        name = ident(index, (unsigned char)payload.at(1));
+        position = 2;
+    }
+    else return lines;
+    if (position >= length) return lines;
+    int count = (unsigned char)payload.at(position++);
+    if (count & 0x80)
+    {
+        lines.append(name + "," + QString::fromLatin1(payload.mid(position,
+                                        qMin(count & 0x7F,length-position))));
+        return lines;
+    }
+    QList<qint32> parameters;
+    for (int i = 0; (i < count) && (position+4 <= length); i++)
+    {
+        qint32 value = (unsigned char)payload.at(position)
+                     | ((unsigned char)payload.at(position+1) << 8)
+                     | ((unsigned char)payload.at(position+2) << 16)
+                     | ((unsigned char)payload.at(position+3) << 24);
+        parameters.append(value);
+        position += 4;
+    }
+    lines.append(line(name, parameters));
+    return lines;
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Decode a delta compressed telemetry frame
+
+The payload has the index, a kind of 0 for a key frame or 1 for a delta frame,
+a sequence number and the number of slots in the layout. A key frame then has
+the index, subindex and count of the message in each slot. A bit map of the
+slots present follows, then their values as zig-zag variable length integers.
+A value is absolute the first time its slot is present after a key frame, and
+otherwise the difference from the value last received.
+
+Delta frames are discarded after a break in the sequence until a key frame
+restores the state.
+
+@param[in] payload decoded frame.
+@param[in] length length of the payload without the CRC.
+@returns message lines of the interval.
+*/
+
+QStringList FrameDecoder::decodeDelta(const QByteArray payload, int length)
+{
+    QStringList lines;
+    if (length < 4) return lines;
+    bool key = (payload.at(1) == 0);
+    int frameSequence = (unsigned char)payload.at(2);
+    int messages = (unsigned char)payload.at(3);
+    int position = 4;
+    QByteArray frameLayout = layout;
+    QList<qint32> frameValues = values;
+    QList<bool> frameValid = valid;
+    if (key)
+    {
+        if (position + 3*messages > length) return lines;
+        frameLayout = payload.mid(position, 3*messages);
+        position += 3*messages;
+        int number = 0;
+        for (int i = 0; i < frameLayout.size(); i += 3)
+            number += (unsigned char)frameLayout.at(i+2);
+        frameValues.clear();
+        for (int i = 0; i < number; i++) frameValues.append(0);
+        frameValid.clear();
+        for (int i = 0; i < messages; i++) frameValid.append(false);
+    }
+    else if (! synchronized || (frameSequence != ((sequence + 1) & 0xFF))
+             || (messages*3 != layout.size()))
+    {
+        qDebug() << "Delta frame out of sequence";
+        synchronized = false;
+        return lines;
+    }
+    int mapLength = (messages + 7)/8;
+    if (position + mapLength > length) return lines;
+    QByteArray present = payload.mid(position, mapLength);
+    position += mapLength;
+    int start = 0;
+    for (int slot = 0; slot < messages; slot++)
+    {
+        int count = (unsigned char)frameLayout.at(slot*3+2);
+        if (((unsigned char)present.at(slot/8) >> (slot%8)) & 1)
+        {
+            for (int j = 0; j < count; j++)
+            {
+                if (position >= length)
+                {
+                    qDebug() << "Delta frame length error";
+                    synchronized = false;
+                    return QStringList();
+                }
+                quint32 value = 0;
+                int shift = 0;
+                unsigned char byte;
+                do
+                {
+                    byte = payload.at(position++);
+                    if (shift < 32) value |= (quint32)(byte & 0x7F) << shift;
+                    shift += 7;
+                }
+                while ((byte & 0x80) && (position < length));
+                qint32 decoded = (qint32)((value >> 1) ^ (0 - (value & 1)));
+                if (frameValid.at(slot))
+                    decoded = (qint32)((quint32)decoded
+                                     + (quint32)frameValues.at(start+j));
+                frameValues[start+j] = decoded;
+            }
+            frameValid[slot] = true;
+            lines.append(line(ident((unsigned char)frameLayout.at(slot*3),
+                                    (unsigned char)frameLayout.at(slot*3+1)),
+                              frameValues.mid(start, count)));
+        }
+        start += count;
+    }
+    if (position != length)
+    {
+        qDebug() << "Delta frame length error";
+        synchronized = false;
+        return QStringList();
+    }
+    layout = frameLayout;
+    values = frameValues;
+    valid = frameValid;
+    sequence = frameSequence;
+    synchronized = true;
+    return lines;
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Ident from an object index and subindex
+
+@param[in] index object index from 1.
+@param[in] subindex appended as a digit if nonzero.
+@returns ident, empty if the index is unknown.
+*/
+
+QString FrameDecoder::ident(int index, int subindex)
+{
+    if ((index == 0) || (index > NUMINDEX)) return QString();
+    QString name = telemetryIndex[index-1];
+    if (subindex > 0) name += QString::number(subindex);
+    return name;
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Object index of an ident
+
+@param[in] name message ident without any trailing digit.
+@returns object index from 1, or zero if the ident is unknown.
+*/
+
+int FrameDecoder::index(const QString name)
+{
+    for (int i = 0; i < NUMINDEX; i++)
+        if (name == telemetryIndex[i]) return i+1;
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Build a message line
+
+The time in seconds sent with delta compressed telemetry is restored to the
+ISO 8601 time string of the pH message.
+
+@param[in] ident message ident.
+@param[in] parameters integer parameters.
+@returns message line.
+*/
+
+QString FrameDecoder::line(QString ident, QList<qint32> parameters)
+{
+    if ((ident == "dH") && (parameters.size() == 1))
+    {
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(
+                            (qint64)(quint32)parameters.at(0)*1000, Qt::UTC);
+        return "pH," + time.toString("yyyy-MM-ddThh:mm:ss");
+    }
+    QString text = ident;
+    for (int i = 0; i < parameters.size(); i++)
+        text += QString(",%1").arg(parameters.at(i));
+    return text;
+}
@@ -0,0 +1,65 @@
+/*       Data Acquisition Binary Frame Decoder
+
+Binary frames from the remote are decoded back to the ASCII message lines that
+would otherwise have been sent, so that they are processed and saved alike.
+This is shared with the data processing program for raw binary captures.
+
+@date 16 October 2026
+*/
+/****************************************************************************
+ *   Copyright (C) 2016 by Ken Sarkies                                      *
+ *   ksarkies@internode.on.net                                              *
+ *                                                                          *
+ *   This file is part of Data Acquisition Project                          *
+ *                                                                          *
+ *   Data Acquisition is free software; you can redistribute it and/or      *
+ *   modify it under the terms of the GNU General Public License as         *
+ *   published by the Free Software Foundation; either version 2 of the     *
+ *   License, or (at your option) any later version.                        *
+ *                                                                          *
+ *   Data Acquisition is distributed in the hope that it will be useful,    *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU General Public License for more details.                           *
+ *                                                                          *
+ *   You should have received a copy of the GNU General Public License      *
+ *   along with Data Acquisition if not, write to the                       *
+ *   Free Software Foundation, Inc.,                                        *
+ *   51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.              *
+ ***************************************************************************/
+
+#ifndef DATA_ACQUISITION_FRAME_H
+#define DATA_ACQUISITION_FRAME_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+//-----------------------------------------------------------------------------
+/** @brief Binary Frame Decoder.
+
+Each frame is given without its zero delimiter. Delta compressed telemetry is
+decoded against the values of earlier frames, so one decoder must see all
+frames of a stream in order.
+*/
+
+class FrameDecoder
+{
+public:
+    FrameDecoder();
+    void reset();
+    QStringList decode(const QByteArray frame);
+    static QString ident(int index, int subindex);
+    static int index(const QString name);
+private:
+    QStringList decodeDelta(const QByteArray payload, int length);
+    QString line(QString ident, QList<qint32> parameters);
+    QByteArray layout;           //!< Index, subindex and count of each message
+    QList<qint32> values;        //!< Telemetry values last received by slot
+    QList<bool> valid;           //!< Slots received since the last key frame
+    int sequence;                //!< Sequence number of the last delta frame
+    bool synchronized;           //!< A key frame has been received
+};
+
+#endif
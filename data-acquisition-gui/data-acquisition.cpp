@@ -51,8 +51,19 @@ Here the data stream from the remote is received and saved to a file.
 #include <iostream>
 #include <unistd.h>
 
-#define NUMBAUDS 7
-const qint32 bauds[NUMBAUDS] = {2400,4800,9600,19200,38400,57600,115200};
+#define NUMBAUDS 10
+const qint32 bauds[NUMBAUDS] = {2400,4800,9600,19200,38400,57600,115200,
+                                230400,460800,921600};
+/* Time to wait for the remote to confirm a baud rate change, in ms */
+#define BAUDRATE_CONFIRM_TIME 2000
+/* Sequenced commands in flight at most, and their total length which is kept
+within the remote receive buffer. */
+#define COMMAND_WINDOW 8
+#define COMMAND_WINDOW_BYTES 128
+/* Time to wait for acknowledgement of commands in flight, in ms */
+#define COMMAND_ACK_TIME 1000
+/* Times a command is sent before it is given up */
+#define COMMAND_TRIES 3
 /*---------------------------------------------------------------------------*/
 /** Data Acquisition Main Window Constructor
 
@@ -68,9 +79,18 @@ DataAcquisitionGui::DataAcquisitionGui(QString device, uint parameter,
 
     saveFile.clear();
     response.clear();
+    frame.clear();
+    binaryFrames = false;
 
     port = NULL;
     baudrate = parameter;
+    baudrateTimer = new QTimer(this);
+    baudrateTimer->setSingleShot(true);
+    connect(baudrateTimer, SIGNAL(timeout()), this, SLOT(onBaudrateTimeout()));
+    commandSequence = 0;
+    commandTimer = new QTimer(this);
+    commandTimer->setSingleShot(true);
+    connect(commandTimer, SIGNAL(timeout()), this, SLOT(onCommandTimeout()));
     serialDevice = device;
     setSourceComboBox(0);           /* Pick up the top of the detected sources */
 /* Create serial port if it has been specified, otherwise leave to the GUI. */
@@ -146,9 +166,11 @@ void DataAcquisitionGui::setSourceComboBox(int index)
     }
     DataAcquisitionMainUi.sourceComboBox->setCurrentIndex(index);
 
+    DataAcquisitionMainUi.baudrateComboBox->clear();
     for (int i = 0; i < NUMBAUDS; i++)
         DataAcquisitionMainUi.baudrateComboBox->addItem(QString("%1").arg(bauds[i]));
-    DataAcquisitionMainUi.baudrateComboBox->setCurrentIndex(DEFAULT_BAUDRATE);
+    if (port != NULL) setBaudrateComboBox(port->baudRate());
+    else DataAcquisitionMainUi.baudrateComboBox->setCurrentIndex(DEFAULT_BAUDRATE);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -157,6 +179,9 @@ void DataAcquisitionGui::setSourceComboBox(int index)
 This is called when data appears in the serial buffer. Data is pulled in until
 a newline occurs, at which point the assembled command QString is processed.
 
+When the remote changes to binary frames it sends a zero byte, after which data
+is pulled in until the next zero delimiter and the frame is decoded.
+
 All incoming messages are processed here and passed to other windows as appropriate.
 */
 
@@ -166,8 +191,24 @@ void DataAcquisitionGui::onDataAvailable()
     int n=0;
     while (n < data.size())
     {
-        if ((data.at(n) != '\r') && (data.at(n) != '\n')) response += data.at(n);
-        if (data.at(n) == '\n')
+        if (data.at(n) == 0)
+        {
+            if (binaryFrames && (frame.size() > 0))
+            {
+                tick.restart();
+                processFrame(frame);
+            }
+            else
+            {
+                binaryFrames = true;
+                decoder.reset();
+            }
+            frame.clear();
+            response.clear();
+        }
+        else if (binaryFrames) frame += data.at(n);
+        else if ((data.at(n) != '\r') && (data.at(n) != '\n')) response += data.at(n);
+        if (! binaryFrames && (data.at(n) == '\n'))
         {
 /* The current time is saved to ms precision followed by the line. */
             tick.restart();
@@ -178,15 +219,70 @@ void DataAcquisitionGui::onDataAvailable()
     }
 }
 
+/*---------------------------------------------------------------------------*/
+/** @brief Decode a binary frame
+
+The frame is decoded back to its message lines, which are processed and saved
+as if they had been received as lines. A delta compressed frame holds all the
+telemetry of an interval.
+
+A response pB,0 marks the return to ASCII lines.
+*/
+
+void DataAcquisitionGui::processFrame(const QByteArray frame)
+{
+    QStringList lines = decoder.decode(frame);
+    for (int i = 0; i < lines.size(); i++)
+    {
+        if (lines.at(i) == "pB,0") binaryFrames = false;
+        processResponse(lines.at(i));
+    }
+}
+
 /*---------------------------------------------------------------------------*/
 /** @brief Process the incoming serial data
 
-Parse the line and take action on the command received.
+The line is saved as received. A consolidated record is broken out into the
+separate messages it stands for so that the displays are updated alike.
 */
 
 void DataAcquisitionGui::processResponse(const QString response)
 {
 qDebug() << response;
+    if (! saveFile.isEmpty()) saveLine(response);
+    QStringList breakdown = response.split(",");
+    if ((breakdown[0].simplified() == "dA") && (breakdown.size() > 19))
+    {
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(
+                    (qint64)breakdown[1].toUInt()*1000, Qt::UTC);
+        processMessage("pH," + time.toString("yyyy-MM-ddThh:mm:ss"));
+        processMessage("dT," + breakdown[3]);
+        int interfaceEnable = breakdown[2].toInt();
+        for (int i = 0; i < 6; i++)
+        {
+            if ((interfaceEnable & (1 << i)) == 0) continue;
+            processMessage(QString("dB%1,%2,%3").arg(i+1)
+                    .arg(breakdown[4+i+i]).arg(breakdown[5+i+i]));
+        }
+        processMessage("ds," + breakdown[16]);
+        if (breakdown[18].toInt() > 0)
+        {
+            processMessage("dR," + breakdown[18]);
+            processMessage("dr," + breakdown[19]);
+        }
+        processMessage("dX," + breakdown[17]);
+    }
+    else processMessage(response);
+}
+
+/*---------------------------------------------------------------------------*/
+/** @brief Process a message
+
+Parse the line and take action on the command received.
+*/
+
+void DataAcquisitionGui::processMessage(const QString response)
+{
     QStringList breakdown = response.split(",");
     int size = breakdown.size();
     QString firstField;
@@ -195,7 +291,6 @@ qDebug() << response;
     if (size > 1) secondField = breakdown[1].simplified();
     QString thirdField;
     if (size > 2) thirdField = breakdown[2].simplified();
-    if (! saveFile.isEmpty()) saveLine(response);
 /* Preset test parameters. */
     if ((size > 0) && (firstField == "dP"))
     {
@@ -281,6 +376,52 @@ qDebug() << response;
 //            DataAcquisitionMainUi.testTimeToGo->setVisible(false);
         }
     }
+/* Acknowledgement of a sequenced command, 1 if accepted and 0 if not. A command
+not accepted is sent again up to a limit. */
+    if ((size > 2) && (firstField == "aK"))
+    {
+        int sequence = secondField.toInt();
+        if (commandsInFlight.contains(sequence))
+        {
+            Command command = commandsInFlight.take(sequence);
+            if (thirdField.toInt() == 0)
+            {
+                if (command.tries < COMMAND_TRIES)
+                    sendSequenced(sequence, command);
+                else
+                    displayErrorMessage("Command failed: " + command.text);
+            }
+            if (commandsInFlight.isEmpty()) commandTimer->stop();
+            else commandTimer->start(COMMAND_ACK_TIME);
+            sendCommands();
+        }
+    }
+/* Baud rate change. At 0 the remote has been asked to change rate and is about
+to do so, so change the port and confirm at the new rate. At 1 the remote has
+confirmed. At 2 the remote has restored the previous rate. */
+    if ((size > 2) && (firstField == "pU"))
+    {
+        int state = thirdField.toInt();
+        if (state == 0)
+        {
+            port->flush();
+            port->setBaudRate(secondField.toInt());
+            port->write("pU+\n\r");
+            baudrateTimer->start(BAUDRATE_CONFIRM_TIME);
+        }
+        else if (state == 1)
+        {
+            baudrateTimer->stop();
+            previousBaudrate = secondField.toInt();
+        }
+        else
+        {
+            baudrateTimer->stop();
+            port->setBaudRate(secondField.toInt());
+            previousBaudrate = secondField.toInt();
+            setBaudrateComboBox(previousBaudrate);
+        }
+    }
 /* When the time field is received, send back a short message to keep comms
 alive. Also check for calibration as time messages stop during this process. */
     if ((size > 0) && (firstField == "pH"))
@@ -619,6 +760,10 @@ void DataAcquisitionGui::on_connectButton_clicked()
             port->write("pc+\n\r");
 /* This should cause the microcontroller to respond with all data */
             port->write("dS\n\r");
+/* Start a new sequence of commands */
+            port->write("#\n\r");
+            commandQueue.clear();
+            commandsInFlight.clear();
             int baudrate = DataAcquisitionMainUi.baudrateComboBox->currentIndex();
             port->setBaudRate(bauds[baudrate]);
             port->setDataBits(QSerialPort::Data8);
@@ -638,6 +783,7 @@ void DataAcquisitionGui::on_connectButton_clicked()
     else
     {
         disconnect(port, SIGNAL(readyRead()), this, SLOT(onDataAvailable()));
+        commandTimer->stop();
         delete port;
         port = NULL;
         DataAcquisitionMainUi.connectButton->setText("Connect");
@@ -645,6 +791,137 @@ void DataAcquisitionGui::on_connectButton_clicked()
     setSourceComboBox(DataAcquisitionMainUi.sourceComboBox->currentIndex());
 }
 
+//-----------------------------------------------------------------------------
+/** @brief Change the Baud Rate
+
+When connected, the remote is asked to change to the selected baud rate. The
+change is completed when its response is received. A rate the remote does not
+support gets no response, so the confirmation timeout restores the combo box
+and reports the failure. When not connected the selected rate is used for the
+next connection.
+
+@param[in] index: index of the selected baud rate.
+*/
+
+void DataAcquisitionGui::on_baudrateComboBox_activated(int index)
+{
+    if (port == NULL) return;
+    if (baudrateTimer->isActive()) return;
+    previousBaudrate = port->baudRate();
+    if (bauds[index] == previousBaudrate) return;
+    port->write(QString("pU%1\n\r").arg(bauds[index]).toLatin1());
+    baudrateTimer->start(BAUDRATE_CONFIRM_TIME);
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Baud Rate Change not Confirmed
+
+The remote did not confirm the new baud rate, so it will have restored the
+previous rate, or it did not accept the rate at all. Return the port to the
+previous rate.
+*/
+
+void DataAcquisitionGui::onBaudrateTimeout()
+{
+    if (port == NULL) return;
+    port->setBaudRate(previousBaudrate);
+    setBaudrateComboBox(previousBaudrate);
+    displayErrorMessage("Baud rate change failed");
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Send a Command
+
+The command is given a sequence number and queued. Commands are sent as the
+window of commands in flight allows, and each is acknowledged by the remote.
+This allows bursts of commands to be sent at full speed without overrunning the
+remote receive buffer.
+
+@param[in] command: command without line ending.
+*/
+
+void DataAcquisitionGui::sendCommand(const QString command)
+{
+    commandQueue.append(command);
+    sendCommands();
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Send Queued Commands
+
+Commands are taken from the queue while the window allows.
+*/
+
+void DataAcquisitionGui::sendCommands()
+{
+    if (port == NULL) return;
+    int bytes = 0;
+    foreach (Command command, commandsInFlight)
+        bytes += command.text.size() + 6;
+    while (! commandQueue.isEmpty() && (commandsInFlight.size() < COMMAND_WINDOW)
+           && (bytes + commandQueue.first().size() + 6 <= COMMAND_WINDOW_BYTES))
+    {
+        while (commandsInFlight.contains(commandSequence))
+            commandSequence = (commandSequence + 1) & 0xFF;
+        Command command;
+        command.text = commandQueue.takeFirst();
+        command.tries = 0;
+        bytes += command.text.size() + 6;
+        sendSequenced(commandSequence, command);
+        commandSequence = (commandSequence + 1) & 0xFF;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Send a Command with its Sequence Number
+
+@param[in] sequence: sequence number 0-255.
+@param[in] command: command to be sent, which is put in flight.
+*/
+
+void DataAcquisitionGui::sendSequenced(int sequence, Command command)
+{
+    command.tries++;
+    commandsInFlight.insert(sequence, command);
+    port->write(QString("#%1%2\n\r").arg(sequence).arg(command.text).toLatin1());
+    if (! commandTimer->isActive()) commandTimer->start(COMMAND_ACK_TIME);
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Command Acknowledgement Timeout
+
+No acknowledgement has arrived in time, so all commands in flight are sent
+again with their sequence numbers. The remote does not repeat a command that it
+has already accepted.
+*/
+
+void DataAcquisitionGui::onCommandTimeout()
+{
+    if (port == NULL) return;
+    QMap<int,Command> resend = commandsInFlight;
+    commandsInFlight.clear();
+    QMap<int,Command>::const_iterator i;
+    for (i = resend.constBegin(); i != resend.constEnd(); ++i)
+    {
+        if (i.value().tries < COMMAND_TRIES) sendSequenced(i.key(), i.value());
+        else displayErrorMessage("Command failed: " + i.value().text);
+    }
+    sendCommands();
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Show a Baud Rate in the Combo Box
+
+@param[in] rate: baud rate to be shown.
+*/
+
+void DataAcquisitionGui::setBaudrateComboBox(qint32 rate)
+{
+    for (int i = 0; i < NUMBAUDS; i++)
+        if (bauds[i] == rate)
+            DataAcquisitionMainUi.baudrateComboBox->setCurrentIndex(i);
+}
+
 //-----------------------------------------------------------------------------
 /** @brief Settings of display enables for source, loads and devices.
 
@@ -733,9 +1010,11 @@ void DataAcquisitionGui::on_startButton_clicked()
     else if (DataAcquisitionMainUi.timerButton->isChecked()) testType = 2;
     else if (DataAcquisitionMainUi.voltageButton->isChecked()) testType = 3;
     if ((testType == 2) && (testTime == 0)) return;
-    port->write(QString("pT%1\n\r").arg(testTime).toLatin1());
-    port->write(QString("pV%1\n\r").arg(voltageLimit).toLatin1());
-    port->write(QString("pR%1\n\r").arg(testType).toLatin1());
+    sendCommand(QString("pT%1").arg(testTime));
+    sendCommand(QString("pV%1").arg(voltageLimit));
+    sendCommand(QString("pR%1").arg(testType));
+// Only the interfaces being displayed are converted and sent.
+    sendCommand(QString("pI%1").arg(activeInterfaces()));
     if (testType == 2)
     {
         DataAcquisitionMainUi.testTimeToGo->setVisible(true);
@@ -756,32 +1035,32 @@ void DataAcquisitionGui::on_startButton_clicked()
     if (interfaces & (1 << 3))
     {
         if (interfaces & (1 << 0))
-            port->write("aS11\n\r");
+            sendCommand("aS11");
         if (interfaces & (1 << 1))
-            port->write("aS21\n\r");
+            sendCommand("aS21");
         if (interfaces & (1 << 2))
-            port->write("aS31\n\r");
+            sendCommand("aS31");
     }
     if (interfaces & (1 << 4))
     {
         if (interfaces & (1 << 0))
-            port->write("aS12\n\r");
+            sendCommand("aS12");
         if (interfaces & (1 << 1))
-            port->write("aS22\n\r");
+            sendCommand("aS22");
         if (interfaces & (1 << 2))
-            port->write("aS32\n\r");
+            sendCommand("aS32");
     }
     if (interfaces & (1 << 5))
     {
         if (interfaces & (1 << 0))
-            port->write("aS13\n\r");
+            sendCommand("aS13");
         if (interfaces & (1 << 1))
-            port->write("aS23\n\r");
+            sendCommand("aS23");
         if (interfaces & (1 << 2))
-            port->write("aS33\n\r");
+            sendCommand("aS33");
     }
 /* Start the run */
-    port->write("aG\n\r");
+    sendCommand("aG");
 }
 
 //-----------------------------------------------------------------------------
@@ -794,11 +1073,11 @@ void DataAcquisitionGui::on_stopButton_clicked()
 {
     DataAcquisitionMainUi.startButton->
         setStyleSheet("background-color:lightpink;");
-    port->write("aS01\n\r");
-    port->write("aS02\n\r");
-    port->write("aS03\n\r");
+    sendCommand("aS01");
+    sendCommand("aS02");
+    sendCommand("aS03");
 /* Stop the run */
-    port->write("aX\n\r");
+    sendCommand("aX");
 }
 
 /*---------------------------------------------------------------------------*/
@@ -31,10 +31,13 @@ Here the data stream from the remote is received and saved to a file.
 
 #include "ui_data-acquisition-main.h"
 #include "data-acquisition-main.h"
+#include "data-acquisition-frame.h"
 #include <QDir>
 #include <QFile>
 #include <QTime>
 #include <QTimer>
+#include <QMap>
+#include <QStringList>
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QListWidgetItem>
@@ -68,6 +71,9 @@ private slots:
     void on_manualButton_clicked();
     void on_timerButton_clicked();
     void on_voltageButton_clicked();
+    void on_baudrateComboBox_activated(int index);
+    void onBaudrateTimeout();
+    void onCommandTimeout();
     void closeEvent(QCloseEvent*);
 signals:
     void recordMessageReceived(const QString response);
@@ -75,21 +81,42 @@ signals:
 private:
 // User Interface object instance
     Ui::DataAcquisitionMainDialog DataAcquisitionMainUi;
+/* Command awaiting acknowledgement */
+    struct Command
+    {
+        QString text;
+        int tries;
+    };
 // Common code
     void initMainWindow(Ui::DataAcquisitionMainDialog);
     void setSourceComboBox(int index);
 // Methods
     void processResponse(const QString response);
+    void processMessage(const QString response);
+    void processFrame(const QByteArray frame);
     void displayErrorMessage(const QString message);
     void saveLine(QString line);    // Save line to a file
     void ssleep(int seconds);
     int activeInterfaces(void);
+    void setBaudrateComboBox(qint32 rate);
+    void sendCommand(const QString command);
+    void sendCommands();
+    void sendSequenced(int sequence, Command command);
 // Variables
     QString serialDevice;
     uint baudrate;
+    qint32 previousBaudrate;     //!< Baud rate before a change was requested
+    QTimer* baudrateTimer;       //!< Wait for confirmation of a baud rate change
+    QStringList commandQueue;    //!< Commands waiting to be sent
+    QMap<int,Command> commandsInFlight; //!< Commands sent but not acknowledged
+    int commandSequence;         //!< Next command sequence number
+    QTimer* commandTimer;        //!< Wait for acknowledgement of commands
     bool synchronized;
     QString errorMessage;
     QString response;
+    QByteArray frame;            //!< Binary frame being received
+    bool binaryFrames;           //!< Remote is sending binary frames
+    FrameDecoder decoder;        //!< Binary frame decoder
     QSerialPort* port;           	//!< Serial port object pointer
     QDir saveDirectory;
     QString saveFile;
@@ -19,8 +19,10 @@ HEADERS         += data-acquisition.h
 HEADERS         += data-acquisition-main.h
 HEADERS         += data-acquisition-record.h
 HEADERS         += data-acquisition-configure.h
+HEADERS         += data-acquisition-frame.h
 SOURCES         += data-acquisition.cpp
 SOURCES         += data-acquisition-main.cpp
 SOURCES         += data-acquisition-record.cpp
 SOURCES         += data-acquisition-configure.cpp
+SOURCES         += data-acquisition-frame.cpp
 
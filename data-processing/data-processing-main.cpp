@@ -29,6 +29,7 @@ Utility program to aid in analysis if BMS data files.
 
 
 #include "data-processing-main.h"
+#include "../data-acquisition-gui/data-acquisition-frame.h"
 #include <QApplication>
 #include <QString>
 #include <QLineEdit>
@@ -82,7 +83,9 @@ bool DataProcessingGui::success()
 //-----------------------------------------------------------------------------
 /** @brief Open a raw data file for Reading.
 
-This button only opens the file for reading.
+This button only opens the file for reading. A raw binary capture of the remote
+transmissions is first decoded to a text file of the same name, and a binary
+log recorded by the remote is first decoded to a text file.
 */
 
 void DataProcessingGui::on_openReadFileButton_clicked()
@@ -90,12 +93,31 @@ void DataProcessingGui::on_openReadFileButton_clicked()
     QString errorMessage;
     QFileInfo fileInfo;
     QString filename = QFileDialog::getOpenFileName(this,
-                                "Data File","./","Text Files (*.txt)");
+                                "Data File","./",
+                                "Text Files (*.txt);;Binary Captures (*.bin);;All Files (*)");
     if (filename.isEmpty())
     {
         displayErrorMessage("No filename specified");
         return;
     }
+    if (filename.endsWith(".bin"))
+    {
+        filename = convertBinaryFile(filename);
+        if (filename.isEmpty())
+        {
+            displayErrorMessage("Binary capture not decoded");
+            return;
+        }
+    }
+    else if (isBinaryLog(filename))
+    {
+        filename = convertBinaryLog(filename);
+        if (filename.isEmpty())
+        {
+            displayErrorMessage("Binary log not decoded");
+            return;
+        }
+    }
     inFile = new QFile(filename);
     fileInfo.setFile(filename);
 /* Look for start and end times, and determine current zero calibration */
@@ -109,6 +131,242 @@ void DataProcessingGui::on_openReadFileButton_clicked()
     }
 }
 
+//-----------------------------------------------------------------------------
+/** @brief Decode a raw binary capture to a text file.
+
+The capture holds the remote transmissions as received. ASCII lines are copied
+until a zero byte marks the change to binary frames, which are then decoded to
+their message lines, including delta compressed telemetry, until a pB,0
+response marks the return to ASCII lines.
+
+If the text file exists already, the user may keep it or overwrite it.
+
+@param[in] QString binary capture file name.
+@returns QString text file name, empty if the conversion failed or was aborted.
+*/
+
+QString DataProcessingGui::convertBinaryFile(QString filename)
+{
+    QFile binaryFile(filename);
+    if (! binaryFile.open(QIODevice::ReadOnly)) return QString();
+    QFileInfo binaryInfo(filename);
+    QString textFilename = binaryInfo.path() + "/"
+                         + binaryInfo.completeBaseName() + ".txt";
+    bool keep = false;
+    if (decodedFileMessage(textFilename, &keep)) return QString();
+    if (keep) return textFilename;
+    QFile textFile(textFilename);
+    if (! textFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return QString();
+    QTextStream outStream(&textFile);
+    QByteArray data = binaryFile.readAll();
+    FrameDecoder decoder;
+    QByteArray frame;
+    QString line;
+    bool binaryFrames = false;
+    for (int n = 0; n < data.size(); n++)
+    {
+        if (data.at(n) == 0)
+        {
+            if (binaryFrames && (frame.size() > 0))
+            {
+                QStringList lines = decoder.decode(frame);
+                for (int i = 0; i < lines.size(); i++)
+                {
+                    if (lines.at(i) == "pB,0") binaryFrames = false;
+                    outStream << lines.at(i) << "\n";
+                }
+            }
+            else
+            {
+                binaryFrames = true;
+                decoder.reset();
+            }
+            frame.clear();
+            line.clear();
+        }
+        else if (binaryFrames) frame += data.at(n);
+        else if (data.at(n) == '\n')
+        {
+            if (line.size() > 0) outStream << line << "\n";
+            line.clear();
+        }
+        else if (data.at(n) != '\r') line += data.at(n);
+    }
+    return textFilename;
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Check for a binary log.
+
+A binary log is made of sector-aligned blocks, and begins with a header block
+that may follow lines recorded earlier in the same file.
+
+@param[in] QString file name.
+@returns bool true if a binary log header block is found.
+*/
+
+bool DataProcessingGui::isBinaryLog(QString filename)
+{
+    QFile logFile(filename);
+    if (! logFile.open(QIODevice::ReadOnly)) return false;
+    for (qint64 position = 0; position < logFile.size(); position += LOG_BLOCK_SIZE)
+    {
+        logFile.seek(position);
+        if (logFile.read(4) == "DAQH") return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Decode a binary log to a text file.
+
+Each block of LOG_BLOCK_SIZE bytes has a four character magic number and a
+sequence number, and ends with the record count and the CRC-16 of the block.
+The header block gives the record layout and the calibration, which are written
+as the dE identification and the dKx calibration lines. Each record of the
+data blocks that follow is written as a dA consolidated record line. Blocks
+that fail the CRC are skipped and counted in the error message, and any other
+sectors are taken as text lines.
+
+The lines are written to a -log.txt file alongside the binary log, which is then
+processed like any other record file. If the text file exists already, the user
+may keep it or overwrite it.
+
+@param[in] QString binary log file name.
+@returns QString text file name, empty if the conversion failed or was aborted.
+*/
+
+QString DataProcessingGui::convertBinaryLog(QString filename)
+{
+    QFile logFile(filename);
+    if (! logFile.open(QIODevice::ReadOnly)) return QString();
+    QFileInfo logInfo(filename);
+    QString textFilename = logInfo.path() + "/"
+                         + logInfo.completeBaseName() + "-log.txt";
+    bool keep = false;
+    if (decodedFileMessage(textFilename, &keep)) return QString();
+    if (keep) return textFilename;
+    QFile textFile(textFilename);
+    if (! textFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return QString();
+    QTextStream outStream(&textFile);
+    QByteArray data = logFile.readAll();
+    const unsigned char* bytes = (const unsigned char*)data.constData();
+    int fields = 0;
+    int recordLength = 0;
+    QByteArray text;
+    int errors = 0;
+    for (int block = 0; block < data.size(); block += LOG_BLOCK_SIZE)
+    {
+        const unsigned char* b = bytes + block;
+        QByteArray magic = data.mid(block, 4);
+        bool isBlock = (block + LOG_BLOCK_SIZE <= data.size())
+                    && ((magic == "DAQH") || (magic == "DAQB"));
+        if (! isBlock) text += data.mid(block, LOG_BLOCK_SIZE);
+        if (isBlock || (block + LOG_BLOCK_SIZE >= data.size()))
+        {
+            QStringList lines = QString::fromLatin1(text.replace('\0',""))
+                                    .split("\n");
+            for (int i = 0; i < lines.size(); i++)
+                if (lines.at(i).simplified().size() > 0)
+                    outStream << lines.at(i).simplified() << "\n";
+            text.clear();
+        }
+        if (! isBlock) continue;
+        quint16 crc = 0xFFFF;
+        for (int i = 0; i < LOG_BLOCK_SIZE-2; i++)
+        {
+            crc ^= (quint16)b[i] << 8;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if (crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+                else crc <<= 1;
+            }
+        }
+        if (crc != (b[LOG_BLOCK_SIZE-2] | (b[LOG_BLOCK_SIZE-1] << 8)))
+        {
+            errors++;
+            continue;
+        }
+        int count = b[LOG_BLOCK_SIZE-4] | (b[LOG_BLOCK_SIZE-3] << 8);
+        const unsigned char* p = b + 6;
+        if (magic == "DAQH")
+        {
+            fields = p[1];
+            recordLength = p[2] | (p[3] << 8);
+            if (recordLength != fields*4) recordLength = 0;
+            const unsigned char* k = p + 14;
+            for (int i = 0; i < 6; i++, k += 10)
+            {
+                qint32 voltageOffset = k[4] | (k[5] << 8) | (k[6] << 16)
+                                     | ((quint32)k[7] << 24);
+                outStream << QString("dK%1,%2,%3,%4,%5\n").arg(i+1)
+                                .arg(k[0] | (k[1] << 8)).arg(k[2] | (k[3] << 8))
+                                .arg(voltageOffset).arg(k[8] | (k[9] << 8));
+            }
+            outStream << "dE," << QString::fromLatin1((const char*)k) << "\n";
+        }
+        else if (recordLength > 0)
+        {
+            for (int r = 0; (r < count)
+                 && (6 + (r+1)*recordLength <= LOG_BLOCK_SIZE-4); r++)
+            {
+                QString line = "dA";
+                for (int i = 0; i < fields; i++, p += 4)
+                    line += QString(",%1").arg((qint32)(p[0] | (p[1] << 8)
+                                            | (p[2] << 16) | ((quint32)p[3] << 24)));
+                outStream << line << "\n";
+            }
+        }
+    }
+    if (errors > 0)
+        displayErrorMessage(QString("%1 binary log blocks failed the CRC")
+                                .arg(errors));
+    return textFilename;
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Time of a time record or consolidated record.
+
+@param[in] QStringList fields of the record.
+@returns QDateTime time of the record, null if the record has no time.
+*/
+
+QDateTime DataProcessingGui::recordTime(QStringList breakdown)
+{
+    if (breakdown.size() < 2) return QDateTime();
+    QString firstText = breakdown[0].simplified();
+    if (firstText == "pH")
+        return QDateTime::fromString(breakdown[1].simplified(),Qt::ISODate);
+    if (firstText == "dA")
+    {
+/* The remote clock is read as local time, the same as the pH time string */
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(
+                    (qint64)breakdown[1].toUInt()*1000, Qt::UTC);
+        time.setTimeSpec(Qt::LocalTime);
+        return time;
+    }
+    return QDateTime();
+}
+
+//-----------------------------------------------------------------------------
+/** @brief Text of the switch control bits.
+
+Three 2-bit fields give the device number for each of load1, load2 and source.
+
+@param[in] int switch control bits.
+@returns QString device numbers separated by spaces.
+*/
+
+QString DataProcessingGui::switchText(int bits)
+{
+    QString switches;
+    for (int i = 0; i < 3; i++)
+        switches.append(" ").append(QString::number((bits >> (i+i)) & 0x03));
+    return switches;
+}
+
 //-----------------------------------------------------------------------------
 /** @brief Extract All to CSV.
 
@@ -514,22 +772,26 @@ bool DataProcessingGui::combineRecords(QDateTime startTime, QDateTime endTime,
 // load1, load2 and source.
             if (firstText == "ds")
             {
-                switches.clear();
-                uint load1device = (secondField >> 0) & 0x03;
-                QString load1deviceText;
-                load1deviceText.setNum(load1device);
-                if (load1device > 0) switches.append(" ").append(load1deviceText);
-                else switches.append(" 0");
-                uint load2device = (secondField >> 2) & 0x03;
-                QString load2deviceText;
-                load2deviceText.setNum(load2device);
-                if (load2device > 0) switches.append(" ").append(load2deviceText);
-                else switches.append(" 0");
-                uint sourcedevice = (secondField >> 4) & 0x03;
-                QString sourcedeviceText;
-                sourcedeviceText.setNum(sourcedevice);
-                if (sourcedevice > 0) switches.append(" ").append(sourcedeviceText);
-                else switches.append(" 0");
+                switches = switchText(secondField);
+            }
+// A consolidated record holds the whole interval in a fixed order and is
+// passed straight through.
+            if ((firstText == "dA") && (size > 19))
+            {
+                lastTime = time;
+                time = recordTime(breakdown);
+                if (time < lastTime)    // Attempt to correct for faulty time
+                    time = lastTime.addSecs(timeStep);
+                blockStart = false;
+                if ((time > startTime) && ((time <= endTime) || (endTime <= startTime)))
+                {
+                    outStream << time.toString(Qt::ISODate) << ",";
+                    for (int i = 4; i < 16; i++)
+                        outStream << breakdown[i].toFloat()/256 << ",";
+                    outStream << breakdown[3].toFloat()/256 << ",";
+                    outStream << switchText(breakdown[16].toInt()) << ",";
+                    outStream << "\n\r";
+                }
             }
         }
     }
@@ -559,11 +821,8 @@ QDateTime DataProcessingGui::findFirstTimeRecord(QFile* inFile)
         if (size <= 0) break;
         QString firstText = breakdown[0].simplified();
 // Find and extract the time record
-        if ((size > 1) && (firstText == "pH"))
-        {
-            time = QDateTime::fromString(breakdown[1].simplified(),Qt::ISODate);
-            break;
-        }
+        time = recordTime(breakdown);
+        if (! time.isNull()) break;
     }
     return time;
 }
@@ -622,11 +881,9 @@ void DataProcessingGui::scanFile(QFile* inFile)
         QStringList breakdown = lineIn.split(",");
         int length = breakdown.size();
         if (length <= 0) break;
-        QString firstText = breakdown[0].simplified();
-        QString secondText = breakdown[1].simplified();
-        if ((firstText == "pH") && (length > 1))
+        QDateTime time = recordTime(breakdown);
+        if (! time.isNull())
         {
-            QDateTime time = QDateTime::fromString(secondText,Qt::ISODate);
             if (startTime.isNull()) startTime = time;
             endTime = time;
         }
@@ -645,6 +902,50 @@ void DataProcessingGui::displayErrorMessage(QString message)
     DataProcessingMainUi.errorMessageLabel->setText(message);
 }
 
+//-----------------------------------------------------------------------------
+/** @brief Message box for decoded file exists.
+
+Checks the existence of the text file decoded from a binary file and asks for
+decisions about its use: abort, overwrite, or keep the existing file.
+
+@param[in] QString filename: full name of the decoded file.
+@param[out] bool* keep: true if keeping the existing file was selected.
+@returns true if abort was selected.
+*/
+
+bool DataProcessingGui::decodedFileMessage(QString filename, bool* keep)
+{
+    if (QFile::exists(filename))
+    {
+        QMessageBox msgBox;
+        msgBox.setText(QString("A decoded file ").
+                        append(QFileInfo(filename).fileName()).append(" exists."));
+// Decode again over the existing file
+        QPushButton *overwriteButton = msgBox.addButton(tr("Overwrite"),
+                         QMessageBox::AcceptRole);
+// Use the existing file as it is
+        QPushButton *keepButton = msgBox.addButton(tr("Keep"),
+                         QMessageBox::AcceptRole);
+// Quit altogether
+        QPushButton *abortButton = msgBox.addButton(tr("Abort"),
+                         QMessageBox::AcceptRole);
+        msgBox.exec();
+        if (msgBox.clickedButton() == overwriteButton)
+        {
+            QFile::remove(filename);
+        }
+        else if (msgBox.clickedButton() == abortButton)
+        {
+            return true;
+        }
+        else if (msgBox.clickedButton() == keepButton)
+        {
+            *keep = true;
+        }
+    }
+    return false;
+}
+
 //-----------------------------------------------------------------------------
 /** @brief Message box for output file exists.
 
@@ -42,6 +42,9 @@
 
 #define LINE_WIDTH 16
 
+/* Size of each block of a binary log recorded by the remote */
+#define LOG_BLOCK_SIZE 512
+
 #include "ui_data-processing-main.h"
 #include <QDialog>
 #include <QDir>
@@ -83,8 +86,14 @@ private:
                                    QFile* inFile, QFile* outFile, bool header);
     void displayErrorMessage(QString message);
     QDateTime findFirstTimeRecord(QFile* inFile);
+    QString convertBinaryFile(QString filename);
+    bool isBinaryLog(QString filename);
+    QString convertBinaryLog(QString filename);
+    QDateTime recordTime(QStringList breakdown);
+    QString switchText(int bits);
     bool openSaveFile(void);
     bool outfileMessage(QString filename, bool* append);
+    bool decodedFileMessage(QString filename, bool* keep);
     QStringList recordType;
     QStringList recordText;
     QFile* inFile;
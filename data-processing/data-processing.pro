@@ -19,6 +19,8 @@ CONFIG          += qt warn_on release
 # Input
 FORMS           += data-processing-main.ui
 HEADERS         += data-processing-main.h
+HEADERS         += ../data-acquisition-gui/data-acquisition-frame.h
 SOURCES         += data-processing.cpp
 SOURCES         += data-processing-main.cpp
+SOURCES         += ../data-acquisition-gui/data-acquisition-frame.cpp
 
@@ -4,68 +4,211 @@ Copyright (C) K. Sarkies <ksarkies@internode.on.net>
 
 19 September 2012
 
-The buffer is 8 bit and is defined externally. It has the first element
-as the buffer size, the second as the buffer head and the third as the
-buffer tail. Space allocated must be three more than the buffer contents.
+The buffer is 8 bit with storage defined externally, and is managed through a
+control structure. The storage size must be a power of two up to 32768.
 
-Buffer head points to the last data item put in the buffer (if any).
-Buffer tail points to the place behind the next item to be taken.
+The head counts the bytes put to the buffer and the tail counts the bytes
+taken. Both run freely over their 16 bit range and are masked to index the
+storage, so the number of bytes held is their difference.
+
+There must be a single producer that only changes the head and a single
+consumer that only changes the tail, for example an ISR and the main program.
+The data is written before the head is advanced and read before the tail is
+advanced, so no interrupt masking is needed.
 */
 
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
 #include "buffer.h"
 
+/* Stop the compiler moving data accesses across an index update. */
+#define memory_barrier()    __asm__ __volatile__ ("" ::: "memory")
+
 //-----------------------------------------------------------------------------
 
-/* Initialize the buffer to empty, defining the size */
-void buffer_init(uint8_t buffer[], uint8_t size)
+/* Initialize the buffer to empty, with storage of a power of two size. */
+void buffer_init(struct Buffer* buffer, uint8_t* data, uint16_t size)
 {
-	buffer[0] = size;
-	buffer[1] = 0;		/* Head */
-	buffer[2] = 0;		/* Tail */
+    buffer->data = data;
+    buffer->mask = size - 1;
+    buffer->head = 0;
+    buffer->tail = 0;
 }
 
 //-----------------------------------------------------------------------------
 
 /* Get a byte from the buffer. Returns a byte in the lower 8 bits,
 or 0x100 if the buffer has no data. */
-uint16_t buffer_get(uint8_t buffer[])
+uint16_t buffer_get(struct Buffer* buffer)
 {
-    if ( buffer[1] == buffer[2] ) return 0x100;   	/* no data available */
-    uint8_t tmptail = (buffer[2] + 1);
-	if (tmptail == buffer[0]) tmptail = 0;
-    buffer[2] = tmptail; 
-    return (uint16_t) buffer[tmptail+3];
+    uint16_t tail = buffer->tail;
+    if (buffer->head == tail) return 0x100;     /* no data available */
+    uint8_t data = buffer->data[tail & buffer->mask];
+    memory_barrier();
+    buffer->tail = tail + 1;
+    return (uint16_t) data;
 }
 
 //-----------------------------------------------------------------------------
 
 /* Put a byte to the buffer. Returns 0x100 if the buffer has no space. */
-uint16_t buffer_put(uint8_t buffer[], uint8_t data)
+uint16_t buffer_put(struct Buffer* buffer, uint8_t data)
 {
-    uint8_t tmphead  = (buffer[1] + 1);
-	if (tmphead == buffer[0]) tmphead = 0;
-    if (tmphead == buffer[2]) return 0x100;   	/* no space available */
-    buffer[1] = tmphead;
-    buffer[tmphead+3] = data;
-	return 0;
+    uint16_t head = buffer->head;
+    if ((uint16_t)(head - buffer->tail) > buffer->mask) return 0x100;
+    buffer->data[head & buffer->mask] = data;
+    memory_barrier();
+    buffer->head = head + 1;
+    return 0;
 }
 
 //-----------------------------------------------------------------------------
 
-/* Return true if the buffer has space available */
-bool buffer_output_free(uint8_t buffer[])
+/* Put a block of bytes to the buffer. Returns the number of bytes put, which
+is less than the length if the buffer fills. */
+uint16_t buffer_write(struct Buffer* buffer, const uint8_t* data, uint16_t length)
 {
-    uint8_t tmphead  = (buffer[1] + 1);
-	if (tmphead == buffer[0]) tmphead = 0;
-    return (tmphead != buffer[2]);
+    uint16_t head = buffer->head;
+    uint16_t space = buffer_free(buffer);
+    if (length > space) length = space;
+    uint16_t i;
+    for (i = 0; i < length; i++)
+        buffer->data[(head + i) & buffer->mask] = data[i];
+    memory_barrier();
+    buffer->head = head + length;
+    return length;
 }
 
 //-----------------------------------------------------------------------------
 
-/* Return true if the buffer has a byte available */
-bool buffer_input_available(uint8_t buffer[])
+/* Put a byte at an offset beyond the head without making it visible to the
+consumer. A message can then be built in place and patched before it is
+committed. The caller must check that the offset is within the free space. */
+void buffer_poke(struct Buffer* buffer, uint16_t offset, uint8_t data)
+{
+    buffer->data[(buffer->head + offset) & buffer->mask] = data;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Make bytes poked beyond the head visible to the consumer. */
+void buffer_commit(struct Buffer* buffer, uint16_t length)
+{
+    memory_barrier();
+    buffer->head += length;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Get a block of bytes from the buffer. Returns the number of bytes taken,
+which is less than the length if the buffer empties. */
+uint16_t buffer_read(struct Buffer* buffer, uint8_t* data, uint16_t length)
+{
+    uint16_t tail = buffer->tail;
+    uint16_t available = buffer_used(buffer);
+    if (length > available) length = available;
+    uint16_t i;
+    for (i = 0; i < length; i++)
+        data[i] = buffer->data[(tail + i) & buffer->mask];
+    memory_barrier();
+    buffer->tail = tail + length;
+    return length;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Get the contiguous block of data starting at the next byte to be taken,
+which ends at the buffer head or at the end of the buffer storage. Returns the
+number of bytes in the block and sets a pointer to the first byte. The bytes
+remain in the buffer until released. */
+uint16_t buffer_peek_block(struct Buffer* buffer, uint8_t** block)
+{
+    uint16_t start = buffer->tail & buffer->mask;
+    uint16_t length = buffer_used(buffer);
+    uint16_t span = buffer->mask + 1 - start;
+    *block = &buffer->data[start];
+    return (length < span) ? length : span;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Remove a number of bytes from the buffer, previously taken as a block. */
+void buffer_release(struct Buffer* buffer, uint16_t length)
 {
-    return (buffer[1] != buffer[2]);
+    memory_barrier();
+    buffer->tail += length;
 }
 
+//-----------------------------------------------------------------------------
 
+/* Read a byte at an offset from the next byte to be taken, without taking it.
+The offset must be less than the number of bytes held. */
+uint8_t buffer_peek(struct Buffer* buffer, uint16_t offset)
+{
+    return buffer->data[(buffer->tail + offset) & buffer->mask];
+}
+
+//-----------------------------------------------------------------------------
+
+/* Remove a number of bytes from within the buffer, starting at an offset from
+the next byte to be taken. The bytes before the offset are moved up to close
+the gap. This acts as the consumer, so the consumer must not be active. */
+void buffer_remove(struct Buffer* buffer, uint16_t offset, uint16_t length)
+{
+    uint16_t tail = buffer->tail;
+    while (offset > 0)
+    {
+        offset--;
+        buffer->data[(tail + offset + length) & buffer->mask] =
+            buffer->data[(tail + offset) & buffer->mask];
+    }
+    memory_barrier();
+    buffer->tail = tail + length;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the number of bytes held in the buffer */
+uint16_t buffer_used(struct Buffer* buffer)
+{
+    return (uint16_t)(buffer->head - buffer->tail);
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the number of bytes of space left in the buffer */
+uint16_t buffer_free(struct Buffer* buffer)
+{
+    return buffer->mask + 1 - buffer_used(buffer);
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return true if the buffer has space available */
+bool buffer_output_free(struct Buffer* buffer)
+{
+    return (buffer_used(buffer) <= buffer->mask);
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return true if the buffer has a byte available */
+bool buffer_input_available(struct Buffer* buffer)
+{
+    return (buffer->head != buffer->tail);
+}
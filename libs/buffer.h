@@ -31,11 +31,30 @@ data types defined.
 #ifndef BUFFER_H
 #define BUFFER_H
 
-void buffer_init(uint8_t buffer[], uint8_t size);
-uint16_t buffer_get(uint8_t buffer[]);
-uint16_t buffer_put(uint8_t buffer[], uint8_t data);
-bool buffer_output_free(uint8_t buffer[]);
-bool buffer_input_available(uint8_t buffer[]);
+/* Buffer control. The storage size must be a power of two. */
+struct Buffer
+{
+    uint8_t* data;              /* Storage, defined externally */
+    uint16_t mask;              /* Storage size less one */
+    volatile uint16_t head;     /* Count of bytes put, changed by the producer */
+    volatile uint16_t tail;     /* Count of bytes taken, changed by the consumer */
+};
+
+void buffer_init(struct Buffer* buffer, uint8_t* data, uint16_t size);
+uint16_t buffer_get(struct Buffer* buffer);
+uint16_t buffer_put(struct Buffer* buffer, uint8_t data);
+uint16_t buffer_write(struct Buffer* buffer, const uint8_t* data, uint16_t length);
+void buffer_poke(struct Buffer* buffer, uint16_t offset, uint8_t data);
+void buffer_commit(struct Buffer* buffer, uint16_t length);
+uint16_t buffer_read(struct Buffer* buffer, uint8_t* data, uint16_t length);
+uint16_t buffer_peek_block(struct Buffer* buffer, uint8_t** block);
+void buffer_release(struct Buffer* buffer, uint16_t length);
+uint8_t buffer_peek(struct Buffer* buffer, uint16_t offset);
+void buffer_remove(struct Buffer* buffer, uint16_t offset, uint16_t length);
+uint16_t buffer_used(struct Buffer* buffer);
+uint16_t buffer_free(struct Buffer* buffer);
+bool buffer_output_free(struct Buffer* buffer);
+bool buffer_input_available(struct Buffer* buffer);
 
 #endif 
 
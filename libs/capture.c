@@ -0,0 +1,194 @@
+/*	Transient Capture
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+
+Raw A/D scans are copied into a ring buffer as they arrive while the capture is
+armed. When the trigger occurs, either a sample crossing a threshold on a
+selected channel or an external event such as a switch change, the scans are
+kept for a set number of scans after the trigger and the ring is then frozen.
+The ring then holds the requested number of scans before the trigger, or as
+many as were available, followed by those from the trigger on.
+
+Scans are added from the A/D DMA ISR. The capture is read out from the main
+program once complete, after which it must be disarmed to free the buffer.
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+
+static uint16_t captureBuffer[CAPTURE_BUFFER_SIZE];
+static volatile uint8_t captureState = CAPTURE_IDLE;
+static volatile bool eventPending;
+static uint8_t triggerSource;
+static uint8_t length;          /* Samples in each scan */
+static uint8_t triggerChannel;  /* Position in the scan of the level trigger */
+static uint16_t triggerLevel;
+static bool triggerRising;
+static uint16_t lastSample;     /* Previous sample on the trigger channel */
+static uint16_t capacity;       /* Scans held in the ring */
+static uint16_t head;           /* Next scan to be written */
+static uint16_t filled;         /* Scans held so far */
+static uint16_t preScans;       /* Scans requested before the trigger */
+static uint16_t postScans;      /* Scans requested from the trigger */
+static uint16_t preCaptured;    /* Scans actually held before the trigger */
+static uint16_t postCount;      /* Scans held from the trigger */
+
+//-----------------------------------------------------------------------------
+
+/* Arm the capture to trigger on a level crossing on a channel at a position in
+the scan, or on an external event. The numbers of scans before and from the
+trigger are reduced if necessary to fit in the buffer. Returns false if the
+parameters cannot be used. */
+bool capture_arm(uint8_t trigger, uint8_t scanLength, uint8_t channel,
+                 uint16_t threshold, bool rising,
+                 uint16_t preTrigger, uint16_t postTrigger)
+{
+    captureState = CAPTURE_IDLE;
+    if (scanLength == 0) return false;
+    if ((trigger == CAPTURE_TRIGGER_LEVEL) && (channel >= scanLength))
+        return false;
+    capacity = CAPTURE_BUFFER_SIZE/scanLength;
+    if (postTrigger < 1) postTrigger = 1;
+    if (postTrigger > capacity) postTrigger = capacity;
+    if (preTrigger > capacity - postTrigger) preTrigger = capacity - postTrigger;
+    triggerSource = trigger;
+    length = scanLength;
+    triggerChannel = channel;
+    triggerLevel = threshold;
+    triggerRising = rising;
+    preScans = preTrigger;
+    postScans = postTrigger;
+    head = 0;
+    filled = 0;
+    eventPending = false;
+    captureState = CAPTURE_ARMED;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Stop the capture and release the buffer. */
+void capture_disarm(void)
+{
+    captureState = CAPTURE_IDLE;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Signal an external event. The capture triggers at the next block of scans if
+it is armed for events. */
+void capture_event(void)
+{
+    if ((captureState == CAPTURE_ARMED) &&
+        (triggerSource == CAPTURE_TRIGGER_EVENT)) eventPending = true;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Add a block of scans to the ring buffer and test for the trigger. This is
+called from the A/D ISR. Nothing is done unless the capture is armed or
+triggered, or if the scan length does not match that armed. */
+void capture_add_block(uint16_t* samples, uint8_t numberScans,
+                       uint8_t scanLength)
+{
+    if ((captureState != CAPTURE_ARMED) && (captureState != CAPTURE_TRIGGERED))
+        return;
+    if (scanLength != length) return;
+    uint8_t scan;
+    for (scan = 0; scan < numberScans; scan++)
+    {
+        uint16_t* destination = captureBuffer + head*length;
+        uint8_t i;
+        for (i = 0; i < length; i++) destination[i] = samples[i];
+        if (++head >= capacity) head = 0;
+        if (filled < capacity) filled++;
+        if (captureState == CAPTURE_ARMED)
+        {
+            bool triggered = false;
+            if (triggerSource == CAPTURE_TRIGGER_LEVEL)
+            {
+                uint16_t sample = samples[triggerChannel];
+                if (filled > 1)
+                {
+                    if (triggerRising)
+                        triggered = (lastSample < triggerLevel) &&
+                                    (sample >= triggerLevel);
+                    else
+                        triggered = (lastSample > triggerLevel) &&
+                                    (sample <= triggerLevel);
+                }
+                lastSample = sample;
+            }
+            else if (eventPending) triggered = true;
+/* The trigger scan is the first of those kept after the trigger. */
+            if (triggered)
+            {
+                preCaptured = filled - 1;
+                if (preCaptured > preScans) preCaptured = preScans;
+                postCount = 0;
+                captureState = CAPTURE_TRIGGERED;
+            }
+        }
+        if (captureState == CAPTURE_TRIGGERED)
+        {
+            if (++postCount >= postScans)
+            {
+                captureState = CAPTURE_COMPLETE;
+                return;
+            }
+        }
+        samples += scanLength;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the capture state. */
+uint8_t capture_status(void)
+{
+    return captureState;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the number of scans in a completed capture that precede the trigger.
+*/
+uint16_t capture_pre_trigger(void)
+{
+    return preCaptured;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the total number of scans in a completed capture. */
+uint16_t capture_length(void)
+{
+    return preCaptured + postScans;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return a pointer to a scan in a completed capture, counting from the first
+scan kept. */
+uint16_t* capture_scan(uint16_t index)
+{
+    uint16_t first = head + capacity - capture_length();
+    return captureBuffer + ((first + index) % capacity)*length;
+}
+
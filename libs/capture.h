@@ -0,0 +1,61 @@
+/*	Transient Capture
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+
+Capture of raw A/D scans around a trigger into a RAM ring buffer.
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/* Number of A/D samples held in the ring buffer. The number of scans held
+depends on the scan length. */
+#define CAPTURE_BUFFER_SIZE     2048
+
+/* Capture states */
+#define CAPTURE_IDLE            0
+#define CAPTURE_ARMED           1
+#define CAPTURE_TRIGGERED       2
+#define CAPTURE_COMPLETE        3
+
+/* Trigger sources */
+#define CAPTURE_TRIGGER_LEVEL   1
+#define CAPTURE_TRIGGER_EVENT   2
+
+/*--------------------------------------------------------------------------*/
+/* Prototypes */
+/*--------------------------------------------------------------------------*/
+
+bool capture_arm(uint8_t trigger, uint8_t scanLength, uint8_t channel,
+                 uint16_t threshold, bool rising,
+                 uint16_t preTrigger, uint16_t postTrigger);
+void capture_disarm(void);
+void capture_event(void);
+void capture_add_block(uint16_t* samples, uint8_t numberScans,
+                       uint8_t scanLength);
+uint8_t capture_status(void);
+uint16_t capture_pre_trigger(void);
+uint16_t capture_length(void);
+uint16_t* capture_scan(uint16_t index);
+
+#endif
@@ -7,6 +7,32 @@ Communications have the form of a small two character header (ident) followed by
 parameters in ASCII string form separated by commas. Thses are an asynchronous
 TxPDOs in CANopen and therefore nominally of fixed length. 
 
+Optionally the messages can be sent as binary frames. The ident is replaced by
+its object index and any trailing digit as a subindex, followed by a count and
+the parameters as little-endian 32 bit integers (or the string). A CRC-16 is
+appended and the frame is COBS encoded so that a zero byte delimits frames.
+
+Interval telemetry can further be delta compressed. The messages of an interval
+are collected and sent as one frame of differences from the values last sent,
+each zig-zag encoded as a variable length integer. A key frame carrying the
+message layout is sent periodically, whenever a message outside the layout
+appears, and after any loss, so that a receiver can resynchronize. Each frame
+marks the messages of the layout present in that interval, so that messages
+sent at lower rates do not change the layout.
+
+Each message is formatted once and the same line can be passed both to the send
+buffer and to a record sink, such as a file on the SD card, according to the
+outputs selected.
+
+Interval telemetry may be sent selectively, as with mapped CANopen TxPDOs. The
+application marks the messages due in each interval by object index and the
+others are then only recorded.
+
+Each message is queued whole or not at all, and sending never blocks. If the
+send buffer cannot take a message, the overflow policy decides what is lost:
+the oldest queued messages, a proportion of the telemetry intervals, or all
+telemetry until the buffer has drained.
+
 K. Sarkies, 9 December 2016
 */
 
@@ -35,16 +61,70 @@ K. Sarkies, 9 December 2016
 #include "comms.h"
 
 /* Local Prototypes */
+static void frame_list_send(char* ident, int32_t* params, uint8_t number);
+static void frame_string_send(char* ident, char* string);
+static uint8_t frame_header(char* ident, uint8_t* frame);
+static void frame_send(uint8_t* frame, uint8_t length);
+static bool frame_open(uint16_t length);
+static void frame_put(uint8_t byte);
+static void frame_close(void);
+static void cobs_put(uint8_t byte);
+static bool delta_collect(char* ident, int32_t* params, uint8_t number);
+static void delta_frame_send(void);
+static uint16_t delta_values(uint8_t* slot, uint8_t* start, bool put);
+static uint8_t varint_length(uint32_t value);
+static void varint_put(uint32_t value);
+static void comms_put_byte(uint8_t byte);
+static uint8_t line_append(char* line, uint8_t length, char* string);
+static void line_send(char* line, uint8_t length, uint8_t outputs);
+static uint8_t message_output(char* ident);
+static void message_queue(uint8_t* data, uint16_t length);
+static bool message_reserve(uint16_t length);
+static uint16_t discard_oldest(uint16_t needed);
 
 /* Globals */
-uint8_t send_buffer[BUFFER_SIZE+3];
-uint8_t receive_buffer[BUFFER_SIZE+3];
+static uint8_t sendData[SEND_BUFFER_SIZE];
+static uint8_t receiveData[RECEIVE_BUFFER_SIZE];
+struct Buffer send_buffer;
+struct Buffer receive_buffer;
+static bool binaryFrames = false;
+static uint8_t output = OUTPUT_SEND;    /* Outputs taking messages */
+static void (*recordSink)(uint8_t* data, uint16_t length) = 0;
+static volatile bool receiveOverflow = false;   /* Received data was lost */
+static uint8_t overflowPolicy = OVERFLOW_DROP_OLDEST;
+static bool telemetry = false;      /* Messages are interval telemetry */
+static bool telemetrySkip = false;  /* Telemetry of this interval is dropped */
+static uint64_t telemetryDue = TELEMETRY_DUE_ALL;   /* By object index */
+static bool telemetryPaused = false;
+static uint8_t decimationCount = 0;
+static uint32_t overflowCount = 0;  /* Messages that did not fit */
+static uint32_t dropCount = 0;      /* Messages discarded or not queued */
+static uint32_t skipCount = 0;      /* Telemetry intervals not sent */
+static uint16_t frameCrc;           /* CRC of the frame being queued */
+static uint16_t cobsCode;           /* Offset of the COBS code being counted */
+static uint16_t cobsOffset;         /* Offset of the next encoded byte */
+static uint8_t cobsRun;             /* Nonzero bytes since the code */
+static bool deltaFrames = false;
+static int32_t deltaValues[DELTA_VALUES];       /* This interval */
+static int32_t deltaPrevious[DELTA_VALUES];     /* As last sent, by slot */
+static uint8_t deltaLayout[DELTA_MESSAGES*3];   /* Index, subindex, count */
+static uint8_t keyLayout[DELTA_MESSAGES*3];     /* Slots of the last key frame */
+static uint8_t deltaMessages = 0;
+static uint8_t keyMessages = 0;
+static uint32_t slotSent = 0;       /* Slots sent since the last key frame */
+static uint8_t deltaNumber = 0;     /* Values collected this interval */
+static uint8_t deltaSequence = 0;
+static uint8_t keyCount = 0;        /* Frames until the next key frame */
+static bool keyNeeded = true;       /* A frame has been lost */
 
 /* These configuration variables are part of the Object Dictionary. */
 /* This is defined in data-acquisition-objdic and is updated in response to
 received messages. */
 extern union ConfigGroup configData;
 
+/* List of message idents in order of object index, defined in the objdic. */
+extern const char* const telemetryIndex[];
+
 /*--------------------------------------------------------------------------*/
 /** @brief Initialise the Communications Buffers
 
@@ -53,8 +133,8 @@ Globals: send_buffer, receive_buffer
 
 void init_comms_buffers(void)
 {
-	buffer_init(send_buffer,BUFFER_SIZE);
-	buffer_init(receive_buffer,BUFFER_SIZE);
+	buffer_init(&send_buffer,sendData,SEND_BUFFER_SIZE);
+	buffer_init(&receive_buffer,receiveData,RECEIVE_BUFFER_SIZE);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -65,7 +145,7 @@ void init_comms_buffers(void)
 
 bool receive_data_available(void)
 {
-    return buffer_input_available(receive_buffer);
+    return buffer_input_available(&receive_buffer);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -76,18 +156,40 @@ bool receive_data_available(void)
 
 uint8_t get_from_receive_buffer(void)
 {
-    return buffer_get(receive_buffer);
+    return buffer_get(&receive_buffer);
 }
 
 /*--------------------------------------------------------------------------*/
 /** @brief Send data character to the receive buffer
 
+A character that does not fit is lost and the loss is noted.
+
 @param[in] uint8_t: character to put to the send buffer
 */
 
 uint16_t put_to_receive_buffer(uint8_t character)
 {
-    return buffer_put(receive_buffer, character);
+    uint16_t result = buffer_put(&receive_buffer, character);
+    if (result > 0xFF) receiveOverflow = true;
+    return result;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Check if received data has been lost
+
+A character is lost when the receive buffer is full, so it belongs to the last
+line in the buffer. Lines taken from the buffer are therefore suspect until it
+has been emptied, after which the loss is cleared.
+
+@returns bool true if received data may have been lost.
+*/
+
+bool comms_receive_overflow(void)
+{
+    bool overflow = receiveOverflow;
+    if (overflow && ! buffer_input_available(&receive_buffer))
+        receiveOverflow = false;
+    return overflow;
 }
 
 /*--------------------------------------------------------------------------*/
@@ -98,7 +200,33 @@ uint16_t put_to_receive_buffer(uint8_t character)
 
 uint16_t get_from_send_buffer(void)
 {
-    return buffer_get(send_buffer);
+    return buffer_get(&send_buffer);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Get a contiguous block of data from the send buffer
+
+The data stays in the buffer until released, so that it can be transmitted
+directly from the buffer by DMA.
+
+@param[out] block: uint8_t** pointer to the first byte of the block.
+@returns uint16_t: number of bytes in the block, zero if the buffer is empty.
+*/
+
+uint16_t get_send_block(uint8_t** block)
+{
+    return buffer_peek_block(&send_buffer, block);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Release a transmitted block from the send buffer
+
+@param[in] length: uint16_t number of bytes that have been transmitted.
+*/
+
+void release_send_block(uint16_t length)
+{
+    buffer_release(&send_buffer, length);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -113,12 +241,41 @@ The response parameters are converted to ASCII integer.
 
 void data_message_send(char* ident, int32_t param1, int32_t param2)
 {
-    comms_print_string(ident);
-    comms_print_string(",");
-    comms_print_int(param1);
-    comms_print_string(",");
-    comms_print_int(param2);
-    comms_print_string("\r\n");
+    int32_t params[2] = {param1, param2};
+    data_list_send(ident, params, 2);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send a data message with a list of integer parameters
+
+The parameters are converted to ASCII integer and separated by commas,
+directly into the message line. The line is only formed if it is to be sent as
+ASCII or recorded.
+
+@param ident: char* an identifier string recognized by the receiving program.
+@param params: int32_t* array of integer parameters.
+@param number: uint8_t number of parameters.
+*/
+
+void data_list_send(char* ident, int32_t* params, uint8_t number)
+{
+    uint8_t outputs = message_output(ident);
+    if (binaryFrames && ((outputs & OUTPUT_SEND) != 0))
+    {
+        if (! (deltaFrames && telemetry && delta_collect(ident, params, number)))
+            frame_list_send(ident, params, number);
+    }
+    if (binaryFrames && ((outputs & OUTPUT_RECORD) == 0)) return;
+    char line[MESSAGE_SIZE];
+    uint8_t length = line_append(line, 0, ident);
+    uint8_t i;
+    for (i = 0; (i < number) && (length < MESSAGE_SIZE-15); i++)
+    {
+        line[length++] = ',';
+        int_to_ascii(params[i], line+length);
+        while (line[length] != 0) length++;
+    }
+    line_send(line, length, outputs);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -132,10 +289,7 @@ Use to send a simple response to a command.
 
 void send_response(char* ident, int32_t parameter)
 {
-    comms_print_string(ident);
-    comms_print_string(",");
-    comms_print_int(parameter);
-    comms_print_string("\r\n");
+    data_list_send(ident, &parameter, 1);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -149,13 +303,7 @@ Use to send a simple debug response to a command.
 
 void send_debug_response(char* ident, int32_t parameter)
 {
-    if (ident[0] == 'D')
-    {
-        comms_print_string(ident);
-        comms_print_string(",");
-        comms_print_int(parameter);
-        comms_print_string("\r\n");
-    }
+    if (ident[0] == 'D') data_list_send(ident, &parameter, 1);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -169,10 +317,767 @@ Use to send a single string.
 
 void send_string(char* ident, char* string)
 {
-    comms_print_string(ident);
-    comms_print_string(",");
-    comms_print_string(string);
-    comms_print_string("\r\n");
+    uint8_t outputs = message_output(ident);
+    if (binaryFrames && ((outputs & OUTPUT_SEND) != 0))
+        frame_string_send(ident, string);
+    if (binaryFrames && ((outputs & OUTPUT_RECORD) == 0)) return;
+    char line[MESSAGE_SIZE];
+    uint8_t length = line_append(line, 0, ident);
+    length = line_append(line, length, ",");
+    length = line_append(line, length, string);
+    line_send(line, length, outputs);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the sink for recorded messages
+
+@param[in] sink: function taking each recorded message line and its length.
+*/
+
+void comms_set_record_sink(void (*sink)(uint8_t* data, uint16_t length))
+{
+    recordSink = sink;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Select the outputs taking messages
+
+Messages are sent over the link, recorded through the record sink, or both.
+Recorded messages are always ASCII lines, and are recorded whether or not the
+overflow policy lets them be sent.
+
+@param[in] outputs: uint8_t OUTPUT_SEND and OUTPUT_RECORD bits.
+*/
+
+void comms_set_output(uint8_t outputs)
+{
+    output = outputs;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the overflow policy
+
+@param[in] policy: uint8_t one of the OVERFLOW_ policies.
+*/
+
+void comms_set_overflow_policy(uint8_t policy)
+{
+    overflowPolicy = policy;
+    telemetryPaused = false;
+    decimationCount = 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Start a block of interval telemetry
+
+Messages up to comms_telemetry_end() are telemetry, which the decimate and
+pause policies drop in preference to command responses. Whether this interval
+is sent is decided here from the send buffer fill.
+
+Decimate sends only one interval in TELEMETRY_DECIMATION while the buffer is
+more than half full. Pause stops telemetry at the first overflow and resumes
+when the buffer is less than a quarter full.
+*/
+
+void comms_telemetry_start(void)
+{
+    uint16_t used = SEND_BUFFER_SIZE - comms_send_space();
+    telemetry = true;
+    telemetrySkip = false;
+    if (overflowPolicy == OVERFLOW_DECIMATE)
+    {
+        if (used > SEND_BUFFER_SIZE/2)
+        {
+            if (++decimationCount < TELEMETRY_DECIMATION) telemetrySkip = true;
+            else decimationCount = 0;
+        }
+        else decimationCount = 0;
+    }
+    else if (overflowPolicy == OVERFLOW_PAUSE)
+    {
+        if (telemetryPaused && (used < SEND_BUFFER_SIZE/4))
+            telemetryPaused = false;
+        telemetrySkip = telemetryPaused;
+    }
+    if (telemetrySkip) skipCount++;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief End a block of interval telemetry
+
+Delta compressed telemetry collected over the block is sent as one frame. All
+telemetry is due again for the next block.
+*/
+
+void comms_telemetry_end(void)
+{
+    if (deltaMessages > 0) delta_frame_send();
+    deltaMessages = 0;
+    deltaNumber = 0;
+    telemetry = false;
+    telemetrySkip = false;
+    telemetryDue = TELEMETRY_DUE_ALL;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Select the interval telemetry to be sent
+
+Telemetry messages of the current block whose object index bit is clear are
+not sent, but are still recorded if recording is selected. Messages without an
+object index are always sent.
+
+@param[in] due: uint64_t bit map with bit i-1 set for object index i.
+*/
+
+void comms_set_telemetry_due(uint64_t due)
+{
+    telemetryDue = due;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Get the object index of a message ident
+
+Any trailing digit of the ident is removed as the subindex.
+
+@param[in] ident: char* an identifier string recognized by the receiving program.
+@param[out] subindex: uint8_t* to receive the subindex, or zero.
+@returns uint8_t object index from 1, or zero if the ident is not listed.
+*/
+
+uint8_t comms_object_index(char* ident, uint8_t* subindex)
+{
+    uint8_t length = 0;
+    while ((ident[length] != 0) && (length < 8)) length++;
+    *subindex = 0;
+    if ((length > 1) && (ident[length-1] >= '0') && (ident[length-1] <= '9'))
+    {
+        length--;
+        *subindex = ident[length] - '0';
+    }
+    uint8_t index;
+    for (index = 0; telemetryIndex[index] != 0; index++)
+    {
+        const char* entry = telemetryIndex[index];
+        uint8_t i = 0;
+        while ((i < length) && (entry[i] == ident[i])) i++;
+        if ((i == length) && (entry[i] == 0)) return index+1;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Space available in the send buffer
+
+Allows bulk output such as a transient capture to be paced to the link.
+
+@returns uint16_t: number of bytes that can be queued.
+*/
+
+uint16_t comms_send_space(void)
+{
+    return buffer_free(&send_buffer);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Get the overflow counters
+
+@param[out] counters: int32_t* array of three to receive the number of
+messages that overflowed the send buffer, the number of messages lost, and the
+number of telemetry intervals skipped.
+*/
+
+void comms_get_counters(int32_t* counters)
+{
+    counters[0] = overflowCount;
+    counters[1] = dropCount;
+    counters[2] = skipCount;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Append a string to a message line
+
+The line is limited to MESSAGE_SIZE with room kept for the line ending.
+
+@param line: char* message line being built.
+@param length: uint8_t current length of the line.
+@param string: char* string to append.
+@returns uint8_t: new length of the line.
+*/
+
+static uint8_t line_append(char* line, uint8_t length, char* string)
+{
+    while ((*string != 0) && (length < MESSAGE_SIZE-2)) line[length++] = *string++;
+    return length;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Terminate a message line and pass it to the outputs
+
+@param line: char* message line with space for the line ending.
+@param length: uint8_t length of the line.
+@param outputs: uint8_t OUTPUT_SEND and OUTPUT_RECORD bits.
+*/
+
+static void line_send(char* line, uint8_t length, uint8_t outputs)
+{
+    line[length++] = '\r';
+    line[length++] = '\n';
+    if (((outputs & OUTPUT_RECORD) != 0) && (recordSink != 0))
+        recordSink((uint8_t*)line, length);
+    if (! binaryFrames && ((outputs & OUTPUT_SEND) != 0))
+        message_queue((uint8_t*)line, length);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Outputs taking a message
+
+Interval telemetry that is not due in this block is only recorded.
+
+@param ident: char* an identifier string recognized by the receiving program.
+@returns uint8_t: OUTPUT_SEND and OUTPUT_RECORD bits.
+*/
+
+static uint8_t message_output(char* ident)
+{
+    if (! telemetry || (telemetryDue == TELEMETRY_DUE_ALL)) return output;
+    uint8_t subindex;
+    uint8_t index = comms_object_index(ident, &subindex);
+    if ((index == 0) || (index > 64) || ((telemetryDue >> (index-1)) & 1))
+        return output;
+    return output & ~OUTPUT_SEND;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Queue a message according to the overflow policy
+
+The message is put whole to the send buffer and transmission started. If there
+is no room, it is dropped unless the drop oldest policy can make room.
+Telemetry is dropped while skipped by the decimate or pause policies.
+
+@param data: uint8_t* message to be queued.
+@param length: uint16_t length of the message.
+*/
+
+static void message_queue(uint8_t* data, uint16_t length)
+{
+    if (! message_reserve(length)) return;
+    buffer_write(&send_buffer, data, length);
+    comms_transmit_start();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Make room for a message according to the overflow policy
+
+@param length: uint16_t length of the message.
+@returns bool: true if the message can be put to the send buffer.
+*/
+
+static bool message_reserve(uint16_t length)
+{
+    if (telemetry && (telemetrySkip || telemetryPaused))
+    {
+        dropCount++;
+        return false;
+    }
+    if (buffer_free(&send_buffer) < length)
+    {
+        overflowCount++;
+        if (overflowPolicy == OVERFLOW_DROP_OLDEST)
+            dropCount += discard_oldest(length);
+        else if (overflowPolicy == OVERFLOW_PAUSE) telemetryPaused = true;
+        if (buffer_free(&send_buffer) < length)
+        {
+            dropCount++;
+            comms_transmit_start();
+            return false;
+        }
+    }
+    return true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Discard the oldest queued messages
+
+Whole messages are removed from the send buffer until there is room for the
+new message. Messages end in a line feed, or a zero for binary frames. Losing a
+delta frame forces the next to be a key frame.
+
+Transmission is held so that the buffer can be changed behind the transmitter,
+which stops part way through a transfer. The first message may therefore be
+partly sent and is always kept. While the DMA channel is lent to the SD card
+the transmitter is already stopped, and the hold leaves the channel alone.
+
+@param needed: uint16_t space needed in bytes.
+@returns uint16_t: number of messages discarded.
+*/
+
+static uint16_t discard_oldest(uint16_t needed)
+{
+    uint8_t delimiter = binaryFrames ? 0 : '\n';
+    uint16_t discarded = 0;
+    comms_transmit_hold();
+    uint16_t used = buffer_used(&send_buffer);
+    uint16_t space = buffer_free(&send_buffer);
+    uint16_t start = 0;
+    while ((start < used) && (buffer_peek(&send_buffer, start++) != delimiter));
+    uint16_t end = start;
+    while ((space + end - start < needed) && (end < used))
+    {
+        while ((end < used) && (buffer_peek(&send_buffer, end++) != delimiter));
+        discarded++;
+    }
+    buffer_remove(&send_buffer, start, end - start);
+    comms_transmit_release();
+    if (discarded > 0) keyNeeded = true;
+    return discarded;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Select binary framed or ASCII messages
+
+On changing to binary frames a zero delimiter is sent so that the receiver
+discards any partial ASCII line and synchronizes to the first frame.
+
+@param[in] enable: bool true to send all messages as binary frames.
+*/
+
+void comms_set_binary_frames(bool enable)
+{
+    if (enable && ! binaryFrames) comms_put_byte(0);
+    binaryFrames = enable;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Check if messages are sent as binary frames
+
+@returns bool true if binary frames are in use.
+*/
+
+bool comms_binary_frames(void)
+{
+    return binaryFrames;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Select delta compression of interval telemetry
+
+This applies only while binary frames are in use. The first frame sent is a key
+frame.
+
+@param[in] enable: bool true to delta compress interval telemetry.
+*/
+
+void comms_set_delta_frames(bool enable)
+{
+    deltaFrames = enable;
+    keyNeeded = true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Check if interval telemetry is delta compressed
+
+@returns bool true if delta frames are in use.
+*/
+
+bool comms_delta_frames(void)
+{
+    return binaryFrames && deltaFrames;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send a binary frame with a list of integer parameters
+
+The list is truncated if it would overflow the frame.
+
+@param ident: char* an identifier string recognized by the receiving program.
+@param params: int32_t* array of integer parameters.
+@param number: uint8_t number of parameters.
+*/
+
+static void frame_list_send(char* ident, int32_t* params, uint8_t number)
+{
+    uint8_t frame[FRAME_SIZE];
+    uint8_t length = frame_header(ident, frame);
+    uint8_t limit = (FRAME_SIZE - length - 3) >> 2;
+    if (number > limit) number = limit;
+    frame[length++] = number;
+    uint8_t i;
+    for (i = 0; i < number; i++)
+    {
+        uint32_t value = (uint32_t)params[i];
+        frame[length++] = value;
+        frame[length++] = value >> 8;
+        frame[length++] = value >> 16;
+        frame[length++] = value >> 24;
+    }
+    frame_send(frame, length);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send a binary frame with a string parameter
+
+The count has the top bit set to mark a string, and the string is truncated if
+it would overflow the frame.
+
+@param ident: char* an identifier string recognized by the receiving program.
+@param string: char* string parameter.
+*/
+
+static void frame_string_send(char* ident, char* string)
+{
+    uint8_t frame[FRAME_SIZE];
+    uint8_t length = frame_header(ident, frame);
+    uint8_t count = length++;
+    while ((*string != 0) && (length < FRAME_SIZE - 2))
+        frame[length++] = *string++;
+    frame[count] = 0x80 | (length - count - 1);
+    frame_send(frame, length);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Build the frame header from an ident
+
+The ident is looked up in the telemetry index with any trailing digit removed
+and is replaced by its index (from 1) and the digit as a subindex. Idents not
+in the list are sent with index 0 followed by the zero terminated ident.
+
+@param ident: char* an identifier string recognized by the receiving program.
+@param frame: uint8_t* frame buffer to receive the header.
+@returns uint8_t length of the header.
+*/
+
+static uint8_t frame_header(char* ident, uint8_t* frame)
+{
+    uint8_t subindex;
+    uint8_t index = comms_object_index(ident, &subindex);
+    if (index > 0)
+    {
+        frame[0] = index;
+        frame[1] = subindex;
+        return 2;
+    }
+    uint8_t length = 0;
+    while ((ident[length] != 0) && (length < 8)) length++;
+    frame[0] = 0;
+    uint8_t i;
+    for (i = 0; i < length; i++) frame[i+1] = ident[i];
+    frame[length+1] = 0;
+    return length+2;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief COBS encode and queue a frame
+
+@param frame: uint8_t* frame to be sent.
+@param length: uint8_t length of the frame without the CRC.
+*/
+
+static void frame_send(uint8_t* frame, uint8_t length)
+{
+    if (! frame_open(length)) return;
+    uint8_t i;
+    for (i = 0; i < length; i++) frame_put(frame[i]);
+    frame_close();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Start a frame in the send buffer
+
+The frame is encoded directly into the send buffer beyond its head, and is only
+committed when closed. Room is made for the longest encoding of the frame.
+
+@param length: uint16_t length of the frame without the CRC.
+@returns bool: true if the frame can be sent.
+*/
+
+static bool frame_open(uint16_t length)
+{
+    length += 2;
+    if (! message_reserve(length + length/254 + 2)) return false;
+    frameCrc = 0xFFFF;
+    cobsCode = 0;
+    cobsOffset = 1;
+    cobsRun = 0;
+    return true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Add a byte to the open frame
+
+@param byte: uint8_t frame byte.
+*/
+
+static void frame_put(uint8_t byte)
+{
+    frameCrc = crc16_update(frameCrc, byte);
+    cobs_put(byte);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Close the open frame and queue it
+
+The CRC-16 of the frame is appended little-endian, the last COBS code is filled
+in and the frame is ended with a zero delimiter.
+*/
+
+static void frame_close(void)
+{
+    uint16_t crc = frameCrc;
+    cobs_put(crc);
+    cobs_put(crc >> 8);
+    buffer_poke(&send_buffer, cobsCode, cobsRun+1);
+    buffer_poke(&send_buffer, cobsOffset++, 0);
+    buffer_commit(&send_buffer, cobsOffset);
+    comms_transmit_start();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief COBS encode a byte into the send buffer
+
+Each run of nonzero bytes is preceded by a code of one more than its length,
+standing in for the zero that follows it. A run is broken at 254 bytes with a
+code of 255 that has no zero following.
+
+@param byte: uint8_t byte to be encoded.
+*/
+
+static void cobs_put(uint8_t byte)
+{
+    if (byte == 0)
+    {
+        buffer_poke(&send_buffer, cobsCode, cobsRun+1);
+        cobsCode = cobsOffset++;
+        cobsRun = 0;
+        return;
+    }
+    buffer_poke(&send_buffer, cobsOffset++, byte);
+    if (++cobsRun == 254)
+    {
+        buffer_poke(&send_buffer, cobsCode, 255);
+        cobsCode = cobsOffset++;
+        cobsRun = 0;
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief CRC-16 CCITT
+
+Polynomial 0x1021 with initial value 0xFFFF.
+
+@param crc: uint16_t CRC so far.
+@param byte: uint8_t next byte.
+@returns uint16_t updated CRC.
+*/
+
+uint16_t crc16_update(uint16_t crc, uint8_t byte)
+{
+    crc ^= (uint16_t)byte << 8;
+    uint8_t bit;
+    for (bit = 0; bit < 8; bit++)
+    {
+        if (crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+        else crc <<= 1;
+    }
+    return crc;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Collect a telemetry message for a delta frame
+
+Only idents in the telemetry index are collected. Others, and any messages
+beyond the limits of the frame, are sent as ordinary frames.
+
+@param ident: char* an identifier string recognized by the receiving program.
+@param params: int32_t* array of integer parameters.
+@param number: uint8_t number of parameters.
+@returns bool: true if the message was collected.
+*/
+
+static bool delta_collect(char* ident, int32_t* params, uint8_t number)
+{
+    uint8_t header[12];
+    if (frame_header(ident, header) != 2) return false;
+    if ((deltaMessages >= DELTA_MESSAGES) ||
+        (deltaNumber + number > DELTA_VALUES)) return false;
+    uint8_t* entry = deltaLayout + deltaMessages*3;
+    entry[0] = header[0];
+    entry[1] = header[1];
+    entry[2] = number;
+    deltaMessages++;
+    uint8_t i;
+    for (i = 0; i < number; i++) deltaValues[deltaNumber++] = params[i];
+    return true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Send the collected telemetry as a delta frame
+
+The frame has the index of the "dD" ident, a kind of 0 for a key frame or 1 for
+a delta frame, a sequence number and the number of slots in the layout. A key
+frame then has the index, subindex and count of the message in each slot. A
+bit map of the slots present in the interval follows, least significant bit
+first. The values of the present slots follow as zig-zag variable length
+integers. A value is sent absolute the first time its slot is present after a
+key frame, and otherwise as the difference from the value last sent.
+
+Messages keep their order, so a message due less often than the others is
+simply left out of the frames in between. Only a message not found in the
+layout, and so a change of the telemetry sent, makes a new layout.
+
+A receiver discards delta frames after a break in the sequence until the next
+key frame.
+*/
+
+static void delta_frame_send(void)
+{
+    if (telemetrySkip || telemetryPaused)
+    {
+        dropCount++;
+        return;
+    }
+    bool key = keyNeeded || (keyCount == 0);
+    uint8_t slot[DELTA_MESSAGES];
+    uint8_t start[DELTA_MESSAGES];
+    uint8_t i;
+    uint8_t j = 0;
+    for (i = 0; i < deltaMessages; i++)
+    {
+        uint8_t* entry = deltaLayout + i*3;
+        while ((j < keyMessages) && ((keyLayout[j*3] != entry[0]) ||
+                (keyLayout[j*3+1] != entry[1]) || (keyLayout[j*3+2] != entry[2])))
+            j++;
+        if (j >= keyMessages) break;
+        slot[i] = j++;
+    }
+/* A message outside the layout: this interval becomes the layout */
+    if (i < deltaMessages)
+    {
+        for (i = 0; i < deltaMessages*3; i++) keyLayout[i] = deltaLayout[i];
+        keyMessages = deltaMessages;
+        for (i = 0; i < deltaMessages; i++) slot[i] = i;
+        key = true;
+    }
+    uint8_t offset = 0;
+    for (j = 0; j < keyMessages; j++)
+    {
+        start[j] = offset;
+        offset += keyLayout[j*3+2];
+    }
+    uint32_t present = 0;
+    for (i = 0; i < deltaMessages; i++) present |= (uint32_t)1 << slot[i];
+    if (key) slotSent = 0;
+    uint8_t mapLength = (keyMessages + 7)/8;
+    uint8_t header[12];
+    frame_header("dD", header);
+    uint16_t length = 4 + mapLength + delta_values(slot, start, false);
+    if (key) length += keyMessages*3;
+    keyNeeded = false;
+    if (! frame_open(length))
+    {
+        keyNeeded = true;
+        return;
+    }
+    frame_put(header[0]);
+    frame_put(key ? 0 : 1);
+    frame_put(deltaSequence++);
+    frame_put(keyMessages);
+    if (key)
+    {
+        for (i = 0; i < keyMessages*3; i++) frame_put(keyLayout[i]);
+        keyCount = DELTA_KEY_INTERVAL;
+    }
+    keyCount--;
+    for (i = 0; i < mapLength; i++) frame_put(present >> (i*8));
+    delta_values(slot, start, true);
+    slotSent |= present;
+    frame_close();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Zig-zag encoded values or differences of the collected values
+
+Zig-zag encoding interleaves positive and negative values so that small values
+of either sign are small unsigned integers. When put into the frame, the values
+are kept as the last sent for their slots.
+
+@param slot: uint8_t* slot of each collected message.
+@param start: uint8_t* position of the first value of each slot.
+@param put: bool true to put the values into the open frame.
+@returns uint16_t: length of the encoded values in bytes.
+*/
+
+static uint16_t delta_values(uint8_t* slot, uint8_t* start, bool put)
+{
+    uint16_t length = 0;
+    uint8_t n = 0;
+    uint8_t i, j;
+    for (i = 0; i < deltaMessages; i++)
+    {
+        bool absolute = ((slotSent & ((uint32_t)1 << slot[i])) == 0);
+        int32_t* previous = deltaPrevious + start[slot[i]];
+        for (j = 0; j < deltaLayout[i*3+2]; j++, n++)
+        {
+            int32_t value = deltaValues[n];
+            if (! absolute)
+                value = (int32_t)((uint32_t)value - (uint32_t)previous[j]);
+            uint32_t encoded = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+            length += varint_length(encoded);
+            if (put)
+            {
+                varint_put(encoded);
+                previous[j] = deltaValues[n];
+            }
+        }
+    }
+    return length;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Length of a variable length integer
+
+@param value: uint32_t value to be encoded.
+@returns uint8_t number of bytes.
+*/
+
+static uint8_t varint_length(uint32_t value)
+{
+    uint8_t length = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Add a variable length integer to the open frame
+
+Seven bits are sent per byte, least significant first, with the top bit set on
+all but the last byte.
+
+@param value: uint32_t value to be encoded.
+*/
+
+static void varint_put(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        frame_put((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    frame_put(value);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Queue a raw byte for transmission
+
+@param[in] byte: uint8_t byte to be sent.
+*/
+
+static void comms_put_byte(uint8_t byte)
+{
+    comms_print_char((char*)&byte);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -233,27 +1138,42 @@ void comms_print_hex(uint32_t value)
 
 void comms_print_string(char* ch)
 {
-    while(*ch) comms_print_char(ch++);
+    comms_print_block((uint8_t*)ch, string_length(ch));
 }
 
 /*--------------------------------------------------------------------------*/
 /** @brief Print a Character
 
-This is where the characters are queued for the ISR to transmit.
-The ISR is in the hardware module.
+This is where the characters are queued for DMA to transmit.
+The DMA transfers are managed in the hardware module.
 
-Characters are placed on a queue and picked up by the ISR for transmission.
+Characters are placed on a queue and a transfer is started if none is in
+progress. Each transfer takes a contiguous block of the queue, and the next is
+chained from its completion ISR.
 
-Blocks if there is no space left on the queue.
+The overflow policy is applied if there is no space left on the queue.
 
 @param[in] ch: char* pointer to character to be printed.
 */
 
 void comms_print_char(char* ch)
 {
-    comms_enable_tx_interrupt(false);
-    while (buffer_put(send_buffer, *ch) == 0x100);
-    comms_enable_tx_interrupt(true);
+    message_queue((uint8_t*)ch, 1);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Print a Block of Data
+
+The block is queued whole as a message, with the overflow policy applied if
+there is no space left on the queue.
+
+@param[in] data: uint8_t* pointer to the data to be printed.
+@param[in] length: uint16_t number of bytes.
+*/
+
+void comms_print_block(uint8_t* data, uint16_t length)
+{
+    message_queue(data, length);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -270,6 +1190,5 @@ void comms_print_fixed_point(uint32_t param)
     char buffer[32];
     fixed_point_to_ascii(param,buffer);
     comms_print_string(buffer);
-	comms_enable_tx_interrupt(true);
 }
 
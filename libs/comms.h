@@ -25,6 +25,33 @@ Copyright (C) K. Sarkies <ksarkies@internode.on.net>
 #ifndef COMMS_H
 #define COMMS_H
 
+/* Largest binary frame including its CRC, before COBS encoding */
+#define FRAME_SIZE      100
+
+/* Limits of the interval telemetry collected into a delta frame, and the
+number of frames between key frames. The messages must fit a 32 bit map. */
+#define DELTA_VALUES        72
+#define DELTA_MESSAGES      28
+#define DELTA_KEY_INTERVAL  16
+
+/* Longest ASCII message line including its line ending */
+#define MESSAGE_SIZE    200
+
+/* Outputs taking messages */
+#define OUTPUT_SEND     0x01
+#define OUTPUT_RECORD   0x02
+
+/* Send buffer overflow policies */
+#define OVERFLOW_DROP_OLDEST    0
+#define OVERFLOW_DECIMATE       1
+#define OVERFLOW_PAUSE          2
+
+/* One interval in this many is sent under the decimate policy */
+#define TELEMETRY_DECIMATION    4
+
+/* All interval telemetry is sent */
+#define TELEMETRY_DUE_ALL       0xFFFFFFFFFFFFFFFFULL
+
 /*--------------------------------------------------------------------------*/
 /* Prototypes */
 /*--------------------------------------------------------------------------*/
@@ -33,16 +60,35 @@ void init_comms_buffers(void);
 bool receive_data_available(void);
 uint8_t get_from_receive_buffer(void);
 uint16_t put_to_receive_buffer(uint8_t character);
+bool comms_receive_overflow(void);
 uint16_t get_from_send_buffer(void);
+uint16_t get_send_block(uint8_t** block);
+void release_send_block(uint16_t length);
 void data_message_send(char* ident, int32_t parm1, int32_t parm2);
+void data_list_send(char* ident, int32_t* params, uint8_t number);
 void send_response(char* ident, int32_t parameter);
 void send_debug_response(char* ident, int32_t parameter);
 void send_string(char* ident, char* string);
 void send_debug_string(char* ident, char* string);
+void comms_set_binary_frames(bool enable);
+bool comms_binary_frames(void);
+void comms_set_delta_frames(bool enable);
+bool comms_delta_frames(void);
+void comms_set_record_sink(void (*sink)(uint8_t* data, uint16_t length));
+void comms_set_output(uint8_t outputs);
+void comms_set_overflow_policy(uint8_t policy);
+void comms_telemetry_start(void);
+void comms_telemetry_end(void);
+void comms_set_telemetry_due(uint64_t due);
+uint8_t comms_object_index(char* ident, uint8_t* subindex);
+uint16_t crc16_update(uint16_t crc, uint8_t byte);
+uint16_t comms_send_space(void);
+void comms_get_counters(int32_t* counters);
 void comms_print_int(int32_t value);
 void comms_print_hex(uint32_t value);
 void comms_print_string(char* ch);
 void comms_print_char(char* ch);
+void comms_print_block(uint8_t* data, uint16_t length);
 void comms_print_fixed_point(uint32_t value);
 
 #endif 
@@ -0,0 +1,95 @@
+/*	Decimation Filters
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+
+A CIC (cascaded integrator-comb) filter of order N and decimation ratio R has
+the frequency response
+
+    H(f) = [sin(pi.f.R/fs) / (R.sin(pi.f/fs))]^N
+
+where fs is the input sample rate. This has nulls at multiples of the output
+rate fs/R, and each stage adds 13.5dB of attenuation to the first alias band.
+The DC gain of R^N is removed by a shift, as R is restricted to a power of 2,
+and the output is given with 4 fractional bits over the 12 bit input. The
+noise reduction from the decimation provides the extra resolution.
+
+Arithmetic is integer only with no multiplications.
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decimation.h"
+
+//-----------------------------------------------------------------------------
+
+/* Set the filter order and decimation ratio 2^shift, and clear the filter
+state. The order is limited to 1 to DECIMATION_ORDER_MAX and the ratio is
+reduced if needed to keep the bit growth within 32 bits. */
+void decimator_init(struct Decimator* filter, uint8_t order, uint8_t shift)
+{
+    if (order < 1) order = 1;
+    if (order > DECIMATION_ORDER_MAX) order = DECIMATION_ORDER_MAX;
+    if (order*shift > DECIMATION_GROWTH_MAX) shift = DECIMATION_GROWTH_MAX/order;
+    filter->order = order;
+    filter->shift = shift;
+    filter->count = 0;
+    filter->settle = order;
+    uint8_t i;
+    for (i = 0; i < DECIMATION_ORDER_MAX; i++)
+    {
+        filter->integrator[i] = 0;
+        filter->delay[i] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/* Pass a sample through the filter. The integrators run at the input rate and
+the combs at the output rate. Returns true when an output is ready, which is
+every 2^shift samples. The outputs while the combs are filling after the filter
+is set are discarded. */
+bool decimator_add(struct Decimator* filter, uint16_t sample, uint16_t* output)
+{
+    uint32_t value = sample;
+    uint8_t i;
+    for (i = 0; i < filter->order; i++)
+    {
+        filter->integrator[i] += value;
+        value = filter->integrator[i];
+    }
+    if (++filter->count < ((uint32_t)1 << filter->shift)) return false;
+    filter->count = 0;
+    for (i = 0; i < filter->order; i++)
+    {
+        uint32_t difference = value - filter->delay[i];
+        filter->delay[i] = value;
+        value = difference;
+    }
+    if (filter->settle > 0)
+    {
+        filter->settle--;
+        return false;
+    }
+    uint8_t growth = filter->order*filter->shift;
+    if (growth >= DECIMATION_FRACTION_BITS)
+        *output = value >> (growth - DECIMATION_FRACTION_BITS);
+    else
+        *output = value << (DECIMATION_FRACTION_BITS - growth);
+    return true;
+}
+
@@ -0,0 +1,58 @@
+/*	Decimation Filters
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+
+Cascaded integrator-comb decimation of a continuous stream of A/D samples.
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef DECIMATION_H
+#define DECIMATION_H
+
+/* Maximum filter order (number of integrator and comb stages). */
+#define DECIMATION_ORDER_MAX        4
+/* Bit growth allowed over the 12 bit A/D samples so that the filter output
+fits in 32 bits. The order times log2 of the ratio must not exceed this. */
+#define DECIMATION_GROWTH_MAX       20
+/* Fractional bits in the filter output, giving 16 bit values. */
+#define DECIMATION_FRACTION_BITS    4
+
+/* The integrators and combs wrap around freely, which gives the correct output
+provided the output itself is in range. */
+struct Decimator
+{
+    uint32_t integrator[DECIMATION_ORDER_MAX];
+    uint32_t delay[DECIMATION_ORDER_MAX];   /* Comb delay elements */
+    uint8_t order;              /* Number of stages */
+    uint8_t shift;              /* Decimation ratio as a power of 2 */
+    uint32_t count;             /* Samples since the last output */
+    uint8_t settle;             /* Outputs to discard while filling */
+};
+
+/*--------------------------------------------------------------------------*/
+/* Prototypes */
+/*--------------------------------------------------------------------------*/
+
+void decimator_init(struct Decimator* filter, uint8_t order, uint8_t shift);
+bool decimator_add(struct Decimator* filter, uint16_t sample, uint16_t* output);
+
+#endif
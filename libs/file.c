@@ -2,6 +2,21 @@
 
 File management functions are provided.
 
+Writes are held back in the sector buffer of the file object, so that the card
+sees whole sector writes as records accumulate. The file is synchronized,
+writing any partial sector and updating the directory entry, only after a set
+number of bytes or seconds, on request (such as on a power fail warning) and on
+close.
+
+A binary log is written as sector-aligned blocks, each holding whole records
+and ending with a CRC. It begins with a header block describing the records.
+The blocks are formed in a stream buffer of several sectors as the records are
+written. When it is full it is written with a single call, so that the card sees
+one multiple block write with a pre-erase count rather than a write per sector.
+There are two stream buffers. The write of a full one runs in the background
+while records go into the other. The time each write holds up the caller is
+recorded.
+
 K. Sarkies, 10 December 2016
 */
 
@@ -23,6 +38,7 @@ K. Sarkies, 10 December 2016
  */
 
 #include "ff.h"
+#include "diskio.h"
 #include "file.h"
 #include "buffer.h"
 #include "comms.h"
@@ -42,12 +58,36 @@ static FIL file[MAX_OPEN_FILES];    /* file descriptions. */
 static FILINFO fileInfo[MAX_OPEN_FILES];    /* file information (open files) */
 static bool fileSystemUsable;
 static uint8_t filemap;             /* map of open file handles */
+static uint32_t unsyncedBytes[MAX_OPEN_FILES];  /* written since last sync */
+static uint32_t syncTime[MAX_OPEN_FILES];       /* seconds count at last sync */
+static uint16_t syncBytes = SYNC_BYTES_DEFAULT;
+static uint16_t syncSeconds = SYNC_SECONDS_DEFAULT;
+static uint32_t recordCount;        /* Records written */
+static uint32_t sectorCount;        /* Whole sectors written */
+static uint32_t syncCount;          /* File synchronizations */
+static uint16_t logOffset[MAX_OPEN_FILES];      /* in the current log block */
+static uint16_t logCrc[MAX_OPEN_FILES];
+static uint16_t logCount[MAX_OPEN_FILES];       /* records in the block */
+static uint16_t logSequence[MAX_OPEN_FILES];    /* of the next log block */
+static uint8_t logStream[2][LOG_STREAM_SECTORS*LOG_BLOCK_SIZE];
+static uint8_t logStreamFill;       /* stream buffer being filled */
+static uint8_t logStreamHandle = 0xFF;  /* file owning the stream buffer */
+static uint8_t logStreamBlocks;     /* completed blocks in the stream buffer */
+static uint32_t streamWrites;       /* Stream buffer writes */
+static uint32_t streamTime;         /* Total time of stream writes in ms */
+static uint32_t streamLongest;      /* Longest stream write in ms */
 
 /*--------------------------------------------------------------------------*/
 /* Local Prototypes */
 
 static uint8_t find_file_handle(void);
 static void delete_file_handle(uint8_t fileHandle);
+static FRESULT file_write(uint8_t fileHandle, uint8_t* data, uint16_t length);
+static FRESULT file_sync(uint8_t fileHandle);
+static FRESULT log_open_block(uint8_t fileHandle, const char* magic);
+static FRESULT log_close_block(uint8_t fileHandle);
+static void log_put(uint8_t fileHandle, uint8_t* data, uint16_t length);
+static FRESULT log_stream_flush(void);
 /*--------------------------------------------------------------------------*/
 /* Helpers */
 /*--------------------------------------------------------------------------*/
@@ -227,16 +267,26 @@ information for opened files. A value of 0xFF indicates that a file has not
 been opened. If the handle passed is already allocated, the function returns
 with an ACCESS DENIED error.
 
+For an empty file a free contiguous region of the size requested is found, and
+clusters are allocated from it as the file grows, so that writes stream into
+consecutive sectors. The file size only covers the data written, so sectors are
+not read before being written and nothing is left to release on close. If no
+contiguous region is free, clusters are allocated wherever they are free.
+
+NOTE: _USE_EXPAND must be set to 1 in ffconf.h
+
 Globals:
 file[] an array of opened file object structures defined by ChaN FAT FS.
 fileInfo[] an array of file information on open files.
 
 @param[in] char*: file name
 @param[out] uint8_t*: file handle.
+@param[in] uint32_t: bytes to preallocate to an empty file, 0 for none.
 @returns uint8_t: status of operation.
 */
 
-uint8_t open_write_file(char* fileName, uint8_t* writeFileHandle)
+uint8_t open_write_file(char* fileName, uint8_t* writeFileHandle,
+                        uint32_t preallocate)
 {
     FRESULT fileStatus = FR_OK;
     uint8_t fileHandle = 0xFF;
@@ -255,19 +305,29 @@ uint8_t open_write_file(char* fileName, uint8_t* writeFileHandle)
         else
         {
 /* Try to open a file write/read, creating it if necessary.
-Skip to the end of the file to append. */
+Find a contiguous region for an empty file, or skip to the end of the file to
+append. */
             fileStatus = f_open(&file[fileHandle], fileName, \
                                 FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+            if ((fileStatus == FR_OK) && (f_size(&file[fileHandle]) == 0) &&
+                (preallocate > 0))
+                f_expand(&file[fileHandle], preallocate, 0);
 /* Check existence of file and get information array entry. */
             if (fileStatus == FR_OK)
-                fileStatus = f_lseek(&file[fileHandle], f_size(file));
+                fileStatus = f_lseek(&file[fileHandle], f_size(&file[fileHandle]));
             if (fileStatus != FR_OK)
             {
                 delete_file_handle(fileHandle);
                 fileHandle = 0xFF;
             }
             if (fileStatus == FR_OK)
+            {
                 f_stat(fileName, fileInfo+fileHandle);
+                unsyncedBytes[fileHandle] = 0;
+                syncTime[fileHandle] = get_seconds_count();
+                logOffset[fileHandle] = 0;
+                logSequence[fileHandle] = 0;
+            }
             *writeFileHandle = fileHandle;
         }
     }
@@ -380,10 +440,12 @@ uint8_t read_line_from_file(uint8_t fileHandle, char* string)
 
 Store data to the file starting at the end of the file.
 
-Nothing is written if the data block is longer than 80 bytes. The number of
-bytes to write is given by the length less 4. The block length parameter returns
-the actual number written. The number written will be less than from the number
-requested if the disk is full. 
+Nothing is written if the data block is longer than RECORD_LENGTH bytes. The
+number written will be less than from the number requested if the disk is full.
+
+The data is taken into the sector buffer of the file object, and reaches the
+card as each sector is filled. The file is synchronized once the sync policy
+byte count has been written since the last sync.
 
 Globals:
 file[] an array of opened file object structures defined by ChaN FAT FS.
@@ -391,28 +453,199 @@ fileInfo[] an array of file information on open files.
 
 @param[in] uint8_t: file handle.
 @param[in] uint8_t*: length of the data block to be written.
-@param[in] uint8_t*: data block of maximum length 80 bytes
+@param[in] uint8_t*: data block of maximum length RECORD_LENGTH bytes
 @returns uint8_t: status of operation.
 */
 
 uint8_t write_to_file(uint8_t fileHandle, uint8_t* blockLength, uint8_t* data)
 {
     FRESULT fileStatus = FR_OK;
-    UINT numWritten = 0;
-    if (*blockLength < 82)
+    if (! valid_file_handle(fileHandle))
+        fileStatus = FR_INVALID_OBJECT;
+    else if (*blockLength <= RECORD_LENGTH)
     {
-        fileStatus = f_write(&file[fileHandle],data,*blockLength,&numWritten);
-        if (numWritten != *blockLength)
-        {
-            fileStatus = FR_DENIED;
-        }
-/* Flush the cached data to the storage medium */
-        if (fileStatus == FR_OK) f_sync(&file[fileHandle]);
+        fileStatus = file_write(fileHandle, data, *blockLength);
+        recordCount++;
+/* Flush the cached data to the storage medium when enough has accumulated */
+        if ((fileStatus == FR_OK) && (syncBytes > 0) &&
+            (unsyncedBytes[fileHandle] >= syncBytes))
+            fileStatus = sync_file(fileHandle);
     }
     else fileStatus = FR_INVALID_PARAMETER;
     return fileStatus;
 }
 
+/*--------------------------------------------------------------------------*/
+/** @brief Write a binary log header block.
+
+Any log is ended first, so that the log header and the blocks that follow are
+sector-aligned. The header block holds the data given, with its length as the
+record count.
+
+@param[in] uint8_t: file handle.
+@param[in] uint8_t*: header data.
+@param[in] uint16_t: length of the header data, at most LOG_BLOCK_DATA.
+@returns uint8_t: status of operation.
+*/
+
+uint8_t write_log_header(uint8_t fileHandle, uint8_t* data, uint16_t length)
+{
+    if (length > LOG_BLOCK_DATA) return FR_INVALID_PARAMETER;
+    FRESULT fileStatus = end_log(fileHandle);
+    if (fileStatus == FR_OK) fileStatus = log_open_block(fileHandle, "DAQH");
+    if (fileStatus != FR_OK) return fileStatus;
+    log_put(fileHandle, data, length);
+    logCount[fileHandle] = length;
+    return log_close_block(fileHandle);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief End a binary log.
+
+Any log block in progress is completed and written out, and the file is padded
+to a sector boundary. Anything written to the file afterwards, such as ASCII
+lines or a new log header, is then kept clear of the log blocks.
+
+@param[in] uint8_t: file handle.
+@returns uint8_t: status of operation.
+*/
+
+uint8_t end_log(uint8_t fileHandle)
+{
+    if (! valid_file_handle(fileHandle)) return FR_INVALID_OBJECT;
+    FRESULT fileStatus = log_close_block(fileHandle);
+    if (fileStatus == FR_OK) fileStatus = log_stream_flush();
+    uint8_t zero = 0;
+    while ((fileStatus == FR_OK) &&
+           ((f_tell(&file[fileHandle]) % LOG_BLOCK_SIZE) != 0))
+        fileStatus = file_write(fileHandle, &zero, 1);
+    return fileStatus;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Write a record to a binary log.
+
+Records are put whole into log blocks. A block is completed when the next
+record does not fit, and the record starts a new block. The byte limit of the
+sync policy applies to completed blocks written out from the stream buffer.
+
+@param[in] uint8_t: file handle.
+@param[in] uint8_t*: record.
+@param[in] uint16_t: length of the record, at most LOG_BLOCK_DATA.
+@returns uint8_t: status of operation.
+*/
+
+uint8_t write_log_record(uint8_t fileHandle, uint8_t* data, uint16_t length)
+{
+    if (! valid_file_handle(fileHandle)) return FR_INVALID_OBJECT;
+    if (length > LOG_BLOCK_DATA) return FR_INVALID_PARAMETER;
+    FRESULT fileStatus = FR_OK;
+    if ((logOffset[fileHandle] > 0) &&
+        (logOffset[fileHandle] + length > LOG_BLOCK_SIZE - LOG_BLOCK_TRAILER))
+        fileStatus = log_close_block(fileHandle);
+    if ((fileStatus == FR_OK) && (logOffset[fileHandle] == 0))
+        fileStatus = log_open_block(fileHandle, "DAQB");
+    if (fileStatus != FR_OK) return fileStatus;
+    log_put(fileHandle, data, length);
+    logCount[fileHandle]++;
+    recordCount++;
+    if ((syncBytes > 0) && (unsyncedBytes[fileHandle] >= syncBytes))
+        fileStatus = file_sync(fileHandle);
+    return fileStatus;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Synchronize an Open Write file.
+
+Any partial sector held back is written to the card and the directory entry is
+updated, so that all data written so far survives a loss of power. A binary log
+block in progress is completed and the stream buffer is written out first.
+
+@param[in] uint8_t: file handle.
+@returns uint8_t: status of operation.
+*/
+
+uint8_t sync_file(uint8_t fileHandle)
+{
+    if (! valid_file_handle(fileHandle)) return FR_INVALID_OBJECT;
+    FRESULT fileStatus = log_close_block(fileHandle);
+    if ((fileStatus == FR_OK) && (fileHandle == logStreamHandle))
+        fileStatus = log_stream_flush();
+    if (fileStatus == FR_OK) fileStatus = file_sync(fileHandle);
+    return fileStatus;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Synchronize files with data held back too long.
+
+Call regularly from the main program to apply the time limit of the sync
+policy. Only the completed blocks of a binary log are written out. The block in
+progress is left open, so that slow recording still fills whole blocks.
+*/
+
+void sync_file_poll(void)
+{
+    if (syncSeconds == 0) return;
+    uint8_t fileHandle;
+    for (fileHandle = 0; fileHandle < MAX_OPEN_FILES; fileHandle++)
+    {
+        bool streamed = (fileHandle == logStreamHandle);
+        bool heldBack = (unsyncedBytes[fileHandle] > 0) ||
+                        (streamed && (logStreamBlocks > 0));
+        if (heldBack && valid_file_handle(fileHandle) &&
+            (get_seconds_count() - syncTime[fileHandle] >= syncSeconds))
+        {
+            if (streamed) log_stream_flush();
+            file_sync(fileHandle);
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the sync policy.
+
+Written data is synchronized to the card after the given number of bytes or
+seconds, whichever comes first. A zero disables that limit, so that with both
+zero files are only synchronized on request and on close.
+
+@param[in] uint16_t: bytes written between syncs.
+@param[in] uint16_t: longest time in seconds that written data is held back.
+*/
+
+void set_sync_policy(uint16_t bytes, uint16_t seconds)
+{
+    syncBytes = bytes;
+    syncSeconds = seconds;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Get the write counters.
+
+@param[out] uint32_t*: array of three to receive the number of records written,
+the number of whole sectors written and the number of syncs.
+*/
+
+void get_file_counters(uint32_t* counters)
+{
+    counters[0] = recordCount;
+    counters[1] = sectorCount;
+    counters[2] = syncCount;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Get the binary log stream write times.
+
+@param[out] uint32_t*: array of three to receive the number of stream buffer
+writes, their total time and the longest time, both in milliseconds.
+*/
+
+void get_log_stream_counters(uint32_t* counters)
+{
+    counters[0] = streamWrites;
+    counters[1] = streamTime;
+    counters[2] = streamLongest;
+}
+
 /*--------------------------------------------------------------------------*/
 /** @brief Close a file.
 
@@ -440,7 +673,15 @@ uint8_t close_file(uint8_t* fileHandle)
     }
     else
     {
-/* Close the file and delete the handle. */
+/* Close the file and delete the handle. Closing writes any data held back. */
+        log_close_block(*fileHandle);
+        if (*fileHandle == logStreamHandle)
+        {
+            log_stream_flush();
+            logStreamHandle = 0xFF;
+        }
+        if (unsyncedBytes[*fileHandle] > 0) syncCount++;
+        unsyncedBytes[*fileHandle] = 0;
         fileInfo[*fileHandle].fname[0] = 0;
         delete_file_handle(*fileHandle);
         fileStatus = f_close(&file[*fileHandle]);
@@ -522,112 +763,160 @@ static void delete_file_handle(uint8_t fileHandle)
 }
 
 /*--------------------------------------------------------------------------*/
-/** @brief Record a Data Record with One Integer Parameter
+/** @brief Write to a file and count the sectors completed.
 
-The data is recorded to an opened write file.
+@param[in] uint8_t: file handle.
+@param[in] uint8_t*: data to be written.
+@param[in] uint16_t: length of the data.
+@returns FRESULT: status of operation.
+*/
 
-@param[in] char* ident: an identifier string.
-@param[in] int32_t param1: first parameter.
-@param[in] uint8_t* writeFileHandle: File handle for an open writeable file.
-@returns uint8_t file status.
+static FRESULT file_write(uint8_t fileHandle, uint8_t* data, uint16_t length)
+{
+    UINT numWritten = 0;
+    uint32_t sector = f_tell(&file[fileHandle])/_MIN_SS;
+    FRESULT fileStatus = f_write(&file[fileHandle],data,length,&numWritten);
+    if (numWritten != length) fileStatus = FR_DENIED;
+    sectorCount += f_tell(&file[fileHandle])/_MIN_SS - sector;
+    unsyncedBytes[fileHandle] += numWritten;
+    return fileStatus;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Synchronize the data written to a file.
+
+@param[in] uint8_t: file handle.
+@returns FRESULT: status of operation.
 */
 
-uint8_t record_single(char* ident, int32_t param1, uint8_t writeFileHandle)
+static FRESULT file_sync(uint8_t fileHandle)
 {
-    uint8_t fileStatus = FR_DENIED;
-    if (writeFileHandle < 0x7F)
-    {
-        char record[80];
-        string_clear(record);
-        string_append(record, ident);
-        string_append(record, ",");
-        char buffer[20];
-        int_to_ascii(param1, buffer);
-        string_append(record, buffer);
-        string_append(record, "\r\n");
-        uint8_t length = string_length(record);
-        fileStatus = write_to_file(writeFileHandle, &length, (uint8_t*) record);
-    }
+    if (unsyncedBytes[fileHandle] == 0) return FR_OK;
+    FRESULT fileStatus = f_sync(&file[fileHandle]);
+    unsyncedBytes[fileHandle] = 0;
+    syncTime[fileHandle] = get_seconds_count();
+    syncCount++;
     return fileStatus;
 }
 
 /*--------------------------------------------------------------------------*/
-/** @brief Record a Data Record with Two Integer Parameters
+/** @brief Start a binary log block.
 
-The data is recorded to an opened write file.
+The block starts with a four character magic number and a sequence number.
+If the stream buffer holds blocks of another file, these are completed and
+written out first.
 
-@param[in] char* ident: an identifier string.
-@param[in] int32_t param1: first parameter.
-@param[in] int32_t param2: second parameter.
-@param[in] uint8_t* writeFileHandle: File handle for an open writeable file.
-@returns uint8_t file status.
+@param[in] uint8_t: file handle.
+@param[in] char*: magic number.
+@returns FRESULT: status of operation.
 */
 
-uint8_t record_dual(char* ident, int32_t param1, int32_t param2, uint8_t writeFileHandle)
+static FRESULT log_open_block(uint8_t fileHandle, const char* magic)
 {
-    uint8_t fileStatus = FR_DENIED;
-    if (writeFileHandle < 0x7F)
+    if (fileHandle != logStreamHandle)
     {
-        char record[80];
-        string_clear(record);
-        string_append(record, ident);
-        string_append(record, ",");
-        char buffer[20];
-        int_to_ascii(param1, buffer);
-        string_append(record, buffer);
-        string_append(record, ",");
-        int_to_ascii(param2, buffer);
-        string_append(record, buffer);
-        string_append(record, "\r\n");
-        uint8_t length = string_length(record);
-        fileStatus = write_to_file(writeFileHandle, &length, (uint8_t*) record);
+        FRESULT fileStatus = FR_OK;
+        if (logStreamHandle < MAX_OPEN_FILES)
+            fileStatus = log_close_block(logStreamHandle);
+        if (fileStatus == FR_OK) fileStatus = log_stream_flush();
+        if (fileStatus != FR_OK) return fileStatus;
+        logStreamHandle = fileHandle;
     }
-    return fileStatus;
+    uint8_t header[LOG_BLOCK_HEADER];
+    uint8_t i;
+    for (i = 0; i < 4; i++) header[i] = magic[i];
+    header[4] = logSequence[fileHandle] & 0xFF;
+    header[5] = logSequence[fileHandle] >> 8;
+    logSequence[fileHandle]++;
+    logCrc[fileHandle] = 0xFFFF;
+    logCount[fileHandle] = 0;
+    log_put(fileHandle, header, LOG_BLOCK_HEADER);
+    return FR_OK;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Complete a binary log block.
+
+The block is padded with zeros and ends with the record count and the CRC-16
+of the block, both little-endian. Nothing is done if no block is in progress.
+The stream buffer is written out when this fills it.
+
+@param[in] uint8_t: file handle.
+@returns FRESULT: status of operation.
+*/
+
+static FRESULT log_close_block(uint8_t fileHandle)
+{
+    if (logOffset[fileHandle] == 0) return FR_OK;
+    uint8_t zero = 0;
+    while (logOffset[fileHandle] < LOG_BLOCK_SIZE - LOG_BLOCK_TRAILER)
+        log_put(fileHandle, &zero, 1);
+    uint8_t trailer[LOG_BLOCK_TRAILER];
+    trailer[0] = logCount[fileHandle] & 0xFF;
+    trailer[1] = logCount[fileHandle] >> 8;
+    logCrc[fileHandle] = crc16_update(logCrc[fileHandle], trailer[0]);
+    logCrc[fileHandle] = crc16_update(logCrc[fileHandle], trailer[1]);
+    trailer[2] = logCrc[fileHandle] & 0xFF;
+    trailer[3] = logCrc[fileHandle] >> 8;
+    log_put(fileHandle, trailer, LOG_BLOCK_TRAILER);
+    logOffset[fileHandle] = 0;
+    logStreamBlocks++;
+    if (logStreamBlocks >= LOG_STREAM_SECTORS) return log_stream_flush();
+    return FR_OK;
 }
 
 /*--------------------------------------------------------------------------*/
-/** @brief Record a Data Record with a String Parameter
+/** @brief Put data into the current binary log block.
 
-The string is recorded to the opened write file.
+The block in progress follows the completed blocks in the stream buffer.
 
-@param[in] char* ident: an identifier string.
-@param[in] char* string: string to record.
-@param[in] uint8_t* writeFileHandle: File handle for an open writeable file.
-@returns uint8_t file status.
+@param[in] uint8_t: file handle.
+@param[in] uint8_t*: data.
+@param[in] uint16_t: length of the data.
 */
 
-uint8_t record_string(char* ident, char* string, uint8_t writeFileHandle)
+static void log_put(uint8_t fileHandle, uint8_t* data, uint16_t length)
 {
-    uint8_t fileStatus = FR_DENIED;
-    if (writeFileHandle < 0x7F)
+    uint8_t* block = logStream[logStreamFill] + logStreamBlocks*LOG_BLOCK_SIZE;
+    uint16_t i;
+    for (i = 0; i < length; i++)
     {
-        char record[80];
-        string_clear(record);
-        string_append(record, ident);
-        string_append(record, ",");
-        string_append(record, string);
-        string_append(record, "\r\n");
-        uint8_t length = string_length(record);
-        fileStatus = write_to_file(writeFileHandle, &length, (uint8_t*) record);
+        logCrc[fileHandle] = crc16_update(logCrc[fileHandle], data[i]);
+        block[logOffset[fileHandle]++] = data[i];
     }
-    return fileStatus;
 }
 
 /*--------------------------------------------------------------------------*/
-/* @brief Record a fixed point value in ASCII decimal form.
+/** @brief Write out the completed blocks of the stream buffer.
 
-Fixed point arithmetic based on 32 bit signed integer of which the first 8 bits
-are the fractional part.
+The blocks are written with a single call from a sector boundary, which the
+file system passes directly to the card as one multiple block write. This is
+left to run in the background and filling continues in the other buffer. Any
+block in progress, as left by a timed sync, is moved to the start of the other
+buffer to be continued there. The card driver finishes the write before any
+other access, so it is done by the time this buffer is used again. The time
+taken is recorded.
 
-@param[in] param: 32 bit signed integer as uint32_t.
+@returns FRESULT: status of operation.
 */
 
-uint8_t record_fixed_point(char* ident, int32_t param, uint8_t writeFileHandle)
+static FRESULT log_stream_flush(void)
 {
-    char buffer[32];
-    fixed_point_to_ascii(param,buffer);
-    uint8_t fileStatus = record_string(ident, buffer, writeFileHandle);
+    if (logStreamBlocks == 0) return FR_OK;
+    uint32_t start = get_milliseconds_count();
+    disk_set_async(1);
+    FRESULT fileStatus = file_write(logStreamHandle, logStream[logStreamFill],
+                                    logStreamBlocks*LOG_BLOCK_SIZE);
+    disk_set_async(0);
+    uint32_t latency = get_milliseconds_count() - start;
+    streamWrites++;
+    streamTime += latency;
+    if (latency > streamLongest) streamLongest = latency;
+    uint8_t* block = logStream[logStreamFill] + logStreamBlocks*LOG_BLOCK_SIZE;
+    logStreamBlocks = 0;
+    logStreamFill ^= 1;
+    uint16_t i;
+    for (i = 0; i < logOffset[logStreamHandle]; i++)
+        logStream[logStreamFill][i] = block[i];
     return fileStatus;
 }
-
-
@@ -27,6 +27,23 @@ K. Sarkies, 10 December 2016
 #include <stdbool.h>
 
 #define MAX_OPEN_FILES              2
+/* Longest record of a list of parameters, including its line ending */
+#define RECORD_LENGTH               200
+/* Default sync policy: written data is synchronized to the card after this many
+bytes or seconds */
+#define SYNC_BYTES_DEFAULT          4096
+#define SYNC_SECONDS_DEFAULT        10
+/* Contiguous space preallocated to a new write file unless otherwise given */
+#define PREALLOCATE_DEFAULT         1048576
+/* Binary log blocks, each one sector with a magic number and sequence number at
+the start, and the record count and CRC-16 at the end */
+#define LOG_BLOCK_SIZE              512
+#define LOG_BLOCK_HEADER            6
+#define LOG_BLOCK_TRAILER           4
+#define LOG_BLOCK_DATA              (LOG_BLOCK_SIZE-LOG_BLOCK_HEADER-LOG_BLOCK_TRAILER)
+/* Binary log blocks collected for a single multiple block write, in each of the
+two stream buffers */
+#define LOG_STREAM_SECTORS          2
 
 /*--------------------------------------------------------------------------*/
 /* Prototypes */
@@ -38,19 +55,24 @@ uint8_t make_filesystem(void);
 uint8_t get_free_clusters(uint32_t* freeClusters, uint32_t* clusterSize);
 uint8_t read_directory_entry(char* directoryName, char* type, uint32_t* size,
                              char* fileName);
-uint8_t open_write_file(char* fileName, uint8_t* writeFileHandle);
+uint8_t open_write_file(char* fileName, uint8_t* writeFileHandle,
+                        uint32_t preallocate);
 uint8_t open_read_file(char* fileName, uint8_t* readFileHandle);
 uint8_t delete_file(char* fileName);
 uint8_t read_block_from_file(uint8_t fileHandle, uint8_t* blockLength, uint8_t* data);
 uint8_t read_line_from_file(uint8_t fileHandle, char* string);
 uint8_t write_to_file(uint8_t fileHandle, uint8_t* blockLength, uint8_t* data);
+uint8_t sync_file(uint8_t fileHandle);
+void sync_file_poll(void);
+void set_sync_policy(uint16_t bytes, uint16_t seconds);
+void get_file_counters(uint32_t* counters);
+void get_log_stream_counters(uint32_t* counters);
+uint8_t write_log_header(uint8_t fileHandle, uint8_t* data, uint16_t length);
+uint8_t write_log_record(uint8_t fileHandle, uint8_t* data, uint16_t length);
+uint8_t end_log(uint8_t fileHandle);
 uint8_t close_file(uint8_t* fileHandle);
 bool valid_file_handle(uint8_t fileHandle);
 void get_file_name(uint8_t fileHandle, char* fileName);
-uint8_t record_single(char* ident, int32_t param1, uint8_t writeFileHandle);
-uint8_t record_dual(char* ident, int32_t param1, int32_t param2, uint8_t writeFileHandle);
-uint8_t record_string(char* ident, char* string, uint8_t writeFileHandle);
-uint8_t record_fixed_point(char* ident, int32_t param1, uint8_t writeFileHandle);
 
 #endif
 
@@ -37,6 +37,7 @@ K. Sarkies, 10 December 2016
 #include <libopencm3/stm32/i2c.h>
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/pwr.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/cortex.h>
 #include <libopencm3/cm3/nvic.h>
@@ -55,19 +56,31 @@ extern uint32_t __configBlockStart;
 extern uint32_t __configBlockEnd;
 
 /* Local Variables */
-static uint32_t v[NUM_CHANNEL]; /* Buffer used by DMA to dump A/D conversions */
-static bool adceoc;
+/* Circular buffer used by DMA to dump A/D conversions. Each half holds a block
+of complete scans. Each word has the ADC1 result in the lower half and the
+simultaneous ADC2 result in the upper half. */
+static uint32_t v[2*ADC_SCANS_MAX*ADC_SCAN_LENGTH];
+static uint8_t numberChannels;  /* Channels in each scan on each ADC */
+static uint8_t numberScans;     /* Scans in each half of the DMA buffer */
+static uint32_t scanPeriod;     /* Time between scans in processor clocks */
+
+/* USART transmit DMA state */
+static volatile uint16_t txLength;  /* Bytes in the current transfer, 0 if idle */
+static volatile uint8_t txHold;     /* Holds on the transmitter, 0 if running */
+static volatile bool txLent;        /* DMA channel lent to the SD card */
 
 /* Time variables needed when systick is used as a timer */
-static uint32_t secondsCount;
-static uint32_t millisecondsCount;
+static volatile uint32_t secondsCount;
+static volatile uint32_t millisecondsCount;
 static uint32_t downCount;
 
-/* This is provided in the FAT filesystem library */
+/* These are provided in the FAT filesystem library */
 extern void disk_timerproc();
+extern void disk_dma_isr();
 
 /*--------------------------------------------------------------------------*/
 /* Local Prototypes */
+static void usart1_dma_next(void);
 
 /*--------------------------------------------------------------------------*/
 /* Helpers */
@@ -83,8 +96,10 @@ void hardware_init(void)
     gpio_setup();
     systick_setup();
     rtc_setup();
+    pvd_setup();
     dma_adc_setup();
     adc_setup();
+    timer_adc_setup();
     usart1_setup();
 }
 
@@ -92,21 +107,54 @@ void hardware_init(void)
 /** @brief Setup the ADC channels
 
 Specify the A/D channels to the hardware to tell it where to place conversion
-results.
+results. The DMA buffer is reset to match the new scan length.
+
+ADC1 (adc 0) and ADC2 (adc 1) run in dual regular simultaneous mode, so the two
+sequences must be the same length and must not convert the same channel at the
+same position.
 
 @param[in] adc: uint8_t A/D converter number.
-@param[in] numberChannels: uint8_t
+@param[in] channels: uint8_t number of channels in the scan.
 @param[in] channelArray: uint8_t* Array to receive the conversion results.
 */
 
-void set_adc_channel_sequence(uint8_t adc, uint8_t numberChannels, uint8_t* channelArray)
+void set_adc_channel_sequence(uint8_t adc, uint8_t channels, uint8_t* channelArray)
 {
+    if (channels > ADC_SCAN_LENGTH) channels = ADC_SCAN_LENGTH;
     if (adc == 0)
-        adc_set_regular_sequence(ADC1, numberChannels, channelArray);
+    {
+        adc_set_regular_sequence(ADC1, channels, channelArray);
+        numberChannels = channels;
+        dma_adc_setup();
+    }
+    else if (adc == 1)
+        adc_set_regular_sequence(ADC2, channels, channelArray);
 }
 
 /*--------------------------------------------------------------------------*/
-/** @brief Start an A/D Conversion
+/** @brief Set the A/D Block Size
+
+The circular DMA buffer is split into two halves each holding a block of
+complete scans. An interrupt is raised as each half is filled, and the block is
+passed to the application while the other half fills.
+
+@param[in] scans: uint8_t number of scans in each block (1 to ADC_SCANS_MAX).
+*/
+
+void set_adc_block_size(uint8_t scans)
+{
+    if (scans < 1) scans = 1;
+    if (scans > ADC_SCANS_MAX) scans = ADC_SCANS_MAX;
+    numberScans = scans;
+    dma_adc_setup();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Start A/D Conversions
+
+The ADC runs continuously from this point, with results taken by DMA.
+
+In dual mode ADC1 is the master and starts ADC2 with it.
 
 @param[in] adc: uint8_t A/D converter number.
 */
@@ -117,6 +165,115 @@ void start_adc_conversion(uint8_t adc)
         adc_start_conversion_regular(ADC1);
 }
 
+/*--------------------------------------------------------------------------*/
+/** @brief Stop A/D Conversions
+
+The scan trigger is stopped and continuous conversion turned off, then the scan
+in progress is allowed to complete so that the channel sequence and DMA can be
+changed without the scans losing alignment in the DMA buffer. Conversions are
+restarted by setting the scan rate.
+*/
+
+void stop_adc_conversion(void)
+{
+    timer_disable_counter(TIM3);
+	adc_set_single_conversion_mode(ADC1);
+	adc_set_single_conversion_mode(ADC2);
+/* Wait longer than the longest free running scan. */
+    uint32_t i;
+    for (i = 0; i < ADC_SCAN_LENGTH*ADC_CONVERSION_CLOCKS; i++)
+        __asm__("nop");
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the A/D Scan Rate
+
+A nonzero rate causes each scan to be triggered by the TRGO output of timer 3,
+giving a fixed scan rate that is independent of program activity. A zero rate
+sets the ADC to convert continuously at its maximum rate.
+
+Conversions are started by this call.
+
+@param[in] rate: uint16_t scans per second, or zero for free running.
+*/
+
+void set_adc_sample_rate(uint16_t rate)
+{
+    timer_disable_counter(TIM3);
+    if (rate == 0)
+    {
+        scanPeriod = numberChannels*ADC_CONVERSION_CLOCKS;
+	    adc_set_continuous_conversion_mode(ADC2);
+	    adc_set_continuous_conversion_mode(ADC1);
+	    adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_SWSTART);
+        start_adc_conversion(0);
+    }
+    else
+    {
+        if (rate < ADC_SAMPLE_RATE_MIN) rate = ADC_SAMPLE_RATE_MIN;
+        if (rate > ADC_SAMPLE_RATE_MAX) rate = ADC_SAMPLE_RATE_MAX;
+/* The scan in progress completes before the trigger takes over. ADC2 follows
+the ADC1 trigger. */
+	    adc_set_single_conversion_mode(ADC2);
+	    adc_set_single_conversion_mode(ADC1);
+	    adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM3_TRGO);
+        timer_set_period(TIM3, ADC_TIMER_CLOCK/rate - 1);
+        scanPeriod = (ADC_TIMER_CLOCK/rate)*ADC_TIMER_PRESCALE;
+        timer_set_counter(TIM3, 0);
+        timer_enable_counter(TIM3);
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Get the A/D Scan Period
+
+This is the exact time between scans for the scan rate last set, allowing
+quantities sampled at every scan to be integrated over time.
+
+@returns uint32_t time between scans in processor clock cycles.
+*/
+
+uint32_t get_adc_scan_period(void)
+{
+    return scanPeriod;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Set the A/D Watchdog
+
+The ADC2 analog watchdog is set to monitor a single channel, and to interrupt
+as soon as a conversion on that channel falls below the low threshold. The
+interrupt is raised once only, and watchdog_proc() is then called with the
+A/D value. The ADC interrupt has a higher priority than the A/D DMA interrupt
+so that it is not held up by block processing.
+
+@param[in] channel: uint8_t A/D channel converted on ADC2.
+@param[in] lowThreshold: uint16_t A/D value below which the watchdog trips.
+*/
+
+void set_adc_watchdog(uint8_t channel, uint16_t lowThreshold)
+{
+    clear_adc_watchdog();
+	adc_set_watchdog_low_threshold(ADC2, lowThreshold);
+	adc_set_watchdog_high_threshold(ADC2, 0xFFF);
+	adc_enable_analog_watchdog_on_selected_channel(ADC2, channel);
+	adc_enable_analog_watchdog_regular(ADC2);
+	adc_clear_flag(ADC2, ADC_SR_AWD);
+	adc_enable_awd_interrupt(ADC2);
+	nvic_set_priority(NVIC_ADC1_2_IRQ, 0);
+	nvic_enable_irq(NVIC_ADC1_2_IRQ);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Clear the A/D Watchdog
+*/
+
+void clear_adc_watchdog(void)
+{
+	adc_disable_awd_interrupt(ADC2);
+	adc_disable_analog_watchdog_regular(ADC2);
+}
+
 /*--------------------------------------------------------------------------*/
 /** @brief Disable Global interrupts
 */
@@ -136,15 +293,88 @@ void sei(void)
 }
 
 /*--------------------------------------------------------------------------*/
-/** @brief Enable/Disable USART Interrupt
+/** @brief Start USART Transmission
+
+If no DMA transfer is in progress, a transfer of the next contiguous block of
+the send buffer is started. Otherwise the data will be taken up when the
+current transfer completes.
 
-@param[in] enable: uint8_t true to enable the interrupt, false to disable.
+The DMA interrupt is only masked when the transmitter is idle, so that the
+check and start are not interleaved with the chaining in the ISR.
 */
 
-void comms_enable_tx_interrupt(uint8_t enable)
+void comms_transmit_start(void)
 {
-    if (enable) usart_enable_tx_interrupt(USART1);
-    else usart_disable_tx_interrupt(USART1);
+    if ((txLength > 0) || (txHold > 0)) return;
+    nvic_disable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+    if ((txLength == 0) && (txHold == 0)) usart1_dma_next();
+    nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Hold USART Transmission
+
+Holds are counted, and each must be released. On the first hold any transfer
+in progress is stopped and the bytes already sent are released from the send
+buffer. The rest are sent when the last hold is released. Further holds do not
+touch the DMA channel, which may have been lent to the SD card.
+*/
+
+void comms_transmit_hold(void)
+{
+    nvic_disable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+    if (txHold++ == 0)
+    {
+        if (txLength > 0)
+        {
+            dma_disable_channel(DMA1,DMA_CHANNEL4);
+            release_send_block(txLength - dma_get_number_of_data(DMA1,DMA_CHANNEL4));
+            txLength = 0;
+        }
+        usart_disable_tx_dma(USART1);
+        dma_clear_interrupt_flags(DMA1,DMA_CHANNEL4,DMA_TCIF);
+    }
+    nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Release USART Transmission
+
+When the last hold is released the DMA channel is set up again for USART1 TX
+and any waiting data is sent.
+*/
+
+void comms_transmit_release(void)
+{
+    nvic_disable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+    bool resume = (txHold > 0) && (--txHold == 0);
+    if (resume) usart1_dma_setup();
+    nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+    if (resume) comms_transmit_start();
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Lend the USART Transmit DMA Channel
+
+DMA1 channel 4 serves both USART1 TX and SPI2 RX, the latter used by the SD
+card on this board. Transmission is held and the channel interrupt is passed to
+the card driver until the channel is reclaimed.
+*/
+
+void comms_transmit_lend(void)
+{
+    comms_transmit_hold();
+    txLent = true;
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Reclaim the USART Transmit DMA Channel from the SD card
+*/
+
+void comms_transmit_reclaim(void)
+{
+    txLent = false;
+    comms_transmit_release();
 }
 
 /*--------------------------------------------------------------------------*/
@@ -249,6 +479,40 @@ uint32_t get_seconds_count()
 #endif
 }
 
+/*--------------------------------------------------------------------------*/
+/** @brief Read the Time to the Millisecond
+
+Both fields are taken from the same time base. With the RTC the milliseconds
+come from the prescaler divider, which counts down the LSE cycles of the
+current second. The counter is read again in case it moved on meanwhile.
+
+@param[out] seconds: uint32_t* seconds counter value.
+@returns uint16_t milliseconds into that second.
+*/
+
+uint16_t get_time_milliseconds(uint32_t* seconds)
+{
+#if (RTC_SOURCE == RTC)
+    uint32_t divider;
+    do
+    {
+        *seconds = rtc_get_counter_val();
+        divider = rtc_get_prescale_div_val();
+    }
+    while (*seconds != rtc_get_counter_val());
+    return ((0x7FFF - (divider & 0x7FFF))*1000) >> 15;
+#else
+    uint32_t milliseconds;
+    do
+    {
+        *seconds = secondsCount;
+        milliseconds = millisecondsCount;
+    }
+    while (*seconds != secondsCount);
+    return milliseconds % 1000;
+#endif
+}
+
 /*--------------------------------------------------------------------------*/
 /** @brief Set the Time
 
@@ -286,41 +550,6 @@ void set_delay_count(uint32_t time)
     downCount = time;
 }
 
-/*--------------------------------------------------------------------------*/
-/** @brief Return and Reset the A/D End of Conversion Flag
-
-This must be retrieved from a global variable set in the ISR as the hardware
-EOC doesn't always change at the end of a conversion (when multiple conversions
-take place).
-
-@returns uint8_t boolean true if the flag was set; false otherwise.
-*/
-
-bool adc_eoc_is_set(void)
-{
-    if (adceoc)
-    {
-        adceoc = false;
-        return true;
-    }
-    return false;
-}
-
-/*--------------------------------------------------------------------------*/
-/** @brief Return the A/D Conversion Results
-
-Note the channel must be less than the number of channels in the A/D converter.
-
-@param[in] channel: uint8_t A/D channel to be retrieved from the DMA buffer.
-@returns uint32_t last value measured by the A/D converter.
-*/
-
-uint32_t adc_value(uint8_t channel)
-{
-    if (channel > NUM_CHANNEL) return 0;
-    return v[channel];
-}
-
 /*--------------------------------------------------------------------------*/
 /** @brief Make Switch Settings
 
@@ -577,30 +806,43 @@ for STM32F103 this is 72MHz / 8 => 9,000,000 counts per second */
 /*--------------------------------------------------------------------------*/
 /** @brief ADC Setup.
 
-ADC1 is turned on and calibrated.
+ADC1 and ADC2 are turned on and calibrated, and set to dual regular
+simultaneous mode with ADC1 as master.
 */
 
 void adc_setup(void)
 {
-/* Enable the ADC1 clock on APB2 */
+/* Enable the ADC1 and ADC2 clocks on APB2 */
     rcc_periph_clock_enable(RCC_GPIOA);
     rcc_periph_clock_enable(RCC_AFIO);
     rcc_periph_clock_enable(RCC_ADC1);
+    rcc_periph_clock_enable(RCC_ADC2);
 /* ADC clock should be maximum 14MHz, so divide by 8 from 72MHz. */
     rcc_set_adcpre(RCC_CFGR_ADCPRE_PCLK2_DIV8);
-	nvic_enable_irq(NVIC_ADC1_2_IRQ);
-/* Make sure the ADC doesn't run during config. */
+/* Make sure the ADCs don't run during config. */
     adc_power_off(ADC1);
-/* Configure ADC1 for multiple conversion of channels, stopping after the last one. */
+    adc_power_off(ADC2);
+/* Both ADCs convert their channel scans together, paced by ADC1. The ADC2
+results appear in the upper half of the ADC1 data register. */
+	adc_set_dual_mode(ADC_CR1_DUALMOD_RSM);
+/* Configure ADC1 for continuous conversion of the channel scan. The results
+are taken by DMA into a circular buffer. */
 	adc_enable_scan_mode(ADC1);
-	adc_set_single_conversion_mode(ADC1);
+	adc_set_continuous_conversion_mode(ADC1);
 	adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_SWSTART);
 	adc_set_right_aligned(ADC1);
 	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
 	adc_enable_dma(ADC1);
-	adc_enable_eoc_interrupt(ADC1);
+/* ADC2 is set the same but with a software trigger to avoid spurious starts.
+It needs no DMA of its own. */
+	adc_enable_scan_mode(ADC2);
+	adc_set_continuous_conversion_mode(ADC2);
+	adc_enable_external_trigger_regular(ADC2, ADC_CR2_EXTSEL_SWSTART);
+	adc_set_right_aligned(ADC2);
+	adc_set_sample_time_on_all_channels(ADC2, ADC_SMPR_SMP_28DOT5CYC);
 /* Setup the ADC */
     adc_power_on(ADC1);
+    adc_power_on(ADC2);
     /* Wait for ADC starting up. */
     uint32_t i;
     for (i = 0; i < 800000; i++)    /* Wait a bit. */
@@ -608,24 +850,48 @@ void adc_setup(void)
     adc_reset_calibration(ADC1);
     adc_calibrate_async(ADC1);
     while (adc_is_calibrating(ADC1));
-    adceoc = false;
+    adc_reset_calibration(ADC2);
+    adc_calibrate_async(ADC2);
+    while (adc_is_calibrating(ADC2));
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief A/D Trigger Timer Setup
+
+Timer 3 is set up to generate a TRGO output on each update event, which can
+be selected to trigger an A/D scan. The timer is left stopped until a scan rate
+is set.
+*/
+
+void timer_adc_setup(void)
+{
+    rcc_periph_clock_enable(RCC_TIM3);
+    timer_disable_counter(TIM3);
+    timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_set_prescaler(TIM3, ADC_TIMER_PRESCALE-1);
+    timer_set_period(TIM3, 0xFFFF);
+    timer_set_master_mode(TIM3, TIM_CR2_MMS_UPDATE);
 }
 
 /*--------------------------------------------------------------------------*/
 /** @brief DMA Setup
 
 Enable DMA 1 Channel 1 to take conversion data from ADC 1, and also ADC 2 when
-the ADC is used in dual mode. The ADC will dump a burst of data to memory each
-time, and we need to grab it before the next conversions start. This must be
-called after each transfer to reset the memory buffer to the beginning.
+the ADC is used in dual mode. The DMA runs in circular mode over a buffer of
+two blocks of scans, with half and full transfer interrupts signalling that a
+block is ready for processing while the other block is filled.
+
+This is called whenever the scan length or block size is changed.
 */
 
 void dma_adc_setup(void)
 {
+    if (numberChannels == 0) numberChannels = ADC_SCAN_LENGTH;
+    if (numberScans == 0) numberScans = 1;
 /* Enable DMA1 Clock */
 	rcc_periph_clock_enable(RCC_DMA1);
 	dma_channel_reset(DMA1,DMA_CHANNEL1);
-	dma_set_priority(DMA1,DMA_CHANNEL1,DMA_CCR_PL_LOW);
+	dma_set_priority(DMA1,DMA_CHANNEL1,DMA_CCR_PL_HIGH);
 /* We want all 32 bits from the ADC to include ADC2 data */
 	dma_set_memory_size(DMA1,DMA_CHANNEL1,DMA_CCR_MSIZE_32BIT);
 	dma_set_peripheral_size(DMA1,DMA_CHANNEL1,DMA_CCR_PSIZE_32BIT);
@@ -633,9 +899,15 @@ void dma_adc_setup(void)
 	dma_set_read_from_peripheral(DMA1,DMA_CHANNEL1);
 /* The register to target is the ADC1 regular data register */
 	dma_set_peripheral_address(DMA1,DMA_CHANNEL1,(uint32_t)&ADC_DR(ADC1));
-/* The array v[] receives the converted output */
+/* The array v[] receives the converted output, wrapping around at the end */
 	dma_set_memory_address(DMA1,DMA_CHANNEL1,(uint32_t)v);
-	dma_set_number_of_data(DMA1,DMA_CHANNEL1,NUM_CHANNEL);
+	dma_set_number_of_data(DMA1,DMA_CHANNEL1,2*numberScans*numberChannels);
+	dma_enable_circular_mode(DMA1,DMA_CHANNEL1);
+	dma_enable_half_transfer_interrupt(DMA1,DMA_CHANNEL1);
+	dma_enable_transfer_complete_interrupt(DMA1,DMA_CHANNEL1);
+/* Lower priority than the A/D watchdog interrupt */
+	nvic_set_priority(NVIC_DMA1_CHANNEL1_IRQ, 1 << 4);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
 	dma_enable_channel(DMA1,DMA_CHANNEL1);
 }
 
@@ -704,10 +976,26 @@ void rtc_setup(void)
 	exti_set_trigger(EXTI17,EXTI_TRIGGER_RISING);
 }
 
+/*--------------------------------------------------------------------------*/
+/** @brief Power Voltage Detector Setup.
+
+The PVD raises EXTI 16 when the supply falls below PVD_LEVEL, giving warning of
+a power failure. The PWR clock is already enabled by the RTC setup.
+*/
+
+void pvd_setup(void)
+{
+    pwr_enable_power_voltage_detect(PVD_LEVEL);
+    exti_set_trigger(EXTI16, EXTI_TRIGGER_RISING);
+    exti_enable_request(EXTI16);
+    nvic_enable_irq(NVIC_PVD_IRQ);
+}
+
 /*--------------------------------------------------------------------------*/
 /** @brief Initialise USART 1.
 
-USART 1 is configured for 38400 baud, interrupt.and  no flow control.
+USART 1 is configured for the default baud rate, no flow control, interrupt
+receive and DMA transmit.
 */
 
 void usart1_setup(void)
@@ -725,7 +1013,7 @@ void usart1_setup(void)
 	gpio_set_mode(GPIOA, GPIO_MODE_INPUT,
 		      GPIO_CNF_INPUT_FLOAT, GPIO_USART1_RX);
 /* Setup UART parameters. */
-	usart_set_baudrate(USART1, 38400);
+	usart_set_baudrate(USART1, BAUDRATE_DEFAULT);
 	usart_set_databits(USART1, 8);
 	usart_set_stopbits(USART1, USART_STOPBITS_1);
 	usart_set_parity(USART1, USART_PARITY_NONE);
@@ -734,10 +1022,73 @@ void usart1_setup(void)
 /* Enable USART1 receive interrupts. */
 	usart_enable_rx_interrupt(USART1);
 	usart_disable_tx_interrupt(USART1);
+	usart1_dma_setup();
 /* Finally enable the USART. */
 	usart_enable(USART1);
 }
 
+/*--------------------------------------------------------------------------*/
+/** @brief Change the USART 1 Baud Rate.
+
+Waits for the send buffer to empty and the last character to leave so that
+queued messages go out at the rate they were sent for.
+
+@param[in] baudrate: uint32_t new baud rate.
+*/
+
+void usart1_set_baudrate(uint32_t baudrate)
+{
+    uint8_t* block;
+    while ((txLength > 0) || (get_send_block(&block) > 0)) comms_transmit_start();
+	while (! usart_get_flag(USART1,USART_SR_TC));
+	usart_disable(USART1);
+	usart_set_baudrate(USART1, baudrate);
+	usart_enable(USART1);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Initialise USART 1 Transmit DMA.
+
+DMA1 channel 4 moves bytes from the send buffer to the USART data register,
+one contiguous block per transfer. The transfer complete interrupt releases the
+block and chains the next one.
+*/
+
+void usart1_dma_setup(void)
+{
+	rcc_periph_clock_enable(RCC_DMA1);
+	dma_channel_reset(DMA1,DMA_CHANNEL4);
+	dma_set_priority(DMA1,DMA_CHANNEL4,DMA_CCR_PL_LOW);
+	dma_set_memory_size(DMA1,DMA_CHANNEL4,DMA_CCR_MSIZE_8BIT);
+	dma_set_peripheral_size(DMA1,DMA_CHANNEL4,DMA_CCR_PSIZE_8BIT);
+	dma_enable_memory_increment_mode(DMA1,DMA_CHANNEL4);
+	dma_set_read_from_memory(DMA1,DMA_CHANNEL4);
+	dma_set_peripheral_address(DMA1,DMA_CHANNEL4,(uint32_t)&USART_DR(USART1));
+	dma_enable_transfer_complete_interrupt(DMA1,DMA_CHANNEL4);
+/* Lower priority than the A/D DMA interrupt */
+	nvic_set_priority(NVIC_DMA1_CHANNEL4_IRQ, 2 << 4);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+	usart_enable_tx_dma(USART1);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Start the next USART Transmit DMA transfer
+
+Called with the DMA interrupt masked or from the DMA ISR itself. Nothing is
+started if the send buffer is empty.
+*/
+
+static void usart1_dma_next(void)
+{
+    uint8_t* block;
+    txLength = get_send_block(&block);
+    if (txLength == 0) return;
+	dma_disable_channel(DMA1,DMA_CHANNEL4);
+	dma_set_memory_address(DMA1,DMA_CHANNEL4,(uint32_t)block);
+	dma_set_number_of_data(DMA1,DMA_CHANNEL4,txLength);
+	dma_enable_channel(DMA1,DMA_CHANNEL4);
+}
+
 /*--------------------------------------------------------------------------*/
 /** @brief Peripheral Disables.
 
@@ -791,6 +1142,18 @@ void rtc_alarm_isr(void)
 	exti_reset_request(EXTI17);
 }
 
+/*--------------------------------------------------------------------------*/
+/* EXT16/PVD ISR
+
+The supply has fallen below the PVD level.
+*/
+
+void pvd_isr(void)
+{
+	exti_reset_request(EXTI16);
+	power_fail_proc();
+}
+
 /*-----------------------------------------------------------*/
 /** @brief Systick Interrupt Handler
 
@@ -817,43 +1180,81 @@ on other operations of the main program while the processor is awake. */
 /*--------------------------------------------------------------------------*/
 /* USART ISR
 
-Find out what interrupted and get or send data as appropriate.
+Only received data is handled here, as transmission is by DMA.
 */
 
 void usart1_isr(void)
 {
-	static uint16_t data;
-
 /* Check if we were called because of RXNE. */
 	if (usart_get_flag(USART1,USART_SR_RXNE))
 	{
 /* If buffer full we'll just drop it */
 		put_to_receive_buffer((uint8_t) usart_recv(USART1));
 	}
-/* Check if we were called because of TXE. */
-	if (usart_get_flag(USART1,USART_SR_TXE))
-	{
-/* If buffer empty, disable the tx interrupt */
-		data = get_from_send_buffer();
-		if ((data & 0xFF00) > 0) comms_enable_tx_interrupt(false);
-		else usart_send(USART1, (data & 0xFF));
-	}
 }
 
 /*--------------------------------------------------------------------------*/
-/* ADC ISR
+/* DMA USART Transmit ISR
+
+The block just sent is released from the send buffer and the next block, if
+any, is started. While the channel is lent it is receiving from the SD card,
+and the completion is passed to the card driver. A completion left over from a
+transfer stopped by a hold is cleared.
+*/
+
+void dma1_channel4_isr(void)
+{
+    if (dma_get_interrupt_flag(DMA1,DMA_CHANNEL4,DMA_TCIF))
+    {
+        if (txLent)
+        {
+            disk_dma_isr();
+            return;
+        }
+        dma_clear_interrupt_flags(DMA1,DMA_CHANNEL4,DMA_TCIF);
+        if (txHold > 0) return;
+        release_send_block(txLength);
+        txLength = 0;
+        usart1_dma_next();
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/* DMA ADC ISR
 
-Respond to ADC EOC at end of scan.
+Respond to half and full transfer of the circular A/D buffer. The block that
+has just been filled is passed for processing while DMA fills the other half.
+*/
+
+void dma1_channel1_isr(void)
+{
+    if (dma_get_interrupt_flag(DMA1,DMA_CHANNEL1,DMA_HTIF))
+    {
+        dma_clear_interrupt_flags(DMA1,DMA_CHANNEL1,DMA_HTIF);
+        acquisition_proc((uint16_t*)v, numberScans);
+    }
+    if (dma_get_interrupt_flag(DMA1,DMA_CHANNEL1,DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(DMA1,DMA_CHANNEL1,DMA_TCIF);
+        acquisition_proc((uint16_t*)(v+numberScans*numberChannels), numberScans);
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief ADC ISR
 
-The EOC status is lost when DMA reads the data register, so use a global
-variable.
+The ADC2 analog watchdog interrupt is disabled once tripped, and the latest
+ADC2 conversion, being the one that tripped it, is passed on.
 */
 
 void adc1_2_isr(void)
 {
-    adceoc = true;
-/* Clear DMA to restart at beginning of data array */
-	dma_adc_setup();
+    if (adc_get_flag(ADC2, ADC_SR_AWD))
+    {
+        adc_disable_awd_interrupt(ADC2);
+        adc_clear_flag(ADC2, ADC_SR_AWD);
+        watchdog_proc(adc_read_regular(ADC2));
+    }
 }
 
 /*--------------------------------------------------------------------------*/
@@ -37,15 +37,28 @@ Initial 19 December 2016
 #include <stdbool.h>
 #include <stdint.h>
 
-/* Size of communications receive and transmit buffers. */
-#define BUFFER_SIZE 250
+/* Size of communications receive and transmit buffers, powers of two. */
+#define SEND_BUFFER_SIZE        1024
+#define RECEIVE_BUFFER_SIZE     256
+
+/* Serial baud rate at reset */
+#define BAUDRATE_DEFAULT        38400
 
 /* Timer parameters */
 /* register value representing a PWM period of 50 microsec (5 kHz) */
 #define PWM_PERIOD      14400
 
-/* USART */
-#define BAUDRATE        38400
+/* A/D scan trigger timer TIM3 counts at 1MHz from the 72MHz timer clock. The
+16 bit period limits the lowest scan rate. The highest rate that can be
+achieved is limited by the time taken to convert the full scan. */
+#define ADC_TIMER_PRESCALE      72
+#define ADC_TIMER_CLOCK         1000000
+#define ADC_SAMPLE_RATE_MIN     16
+#define ADC_SAMPLE_RATE_MAX     20000
+#define PROCESSOR_CLOCK         72000000
+/* Processor clocks per conversion when free running: 28.5 sample plus 12.5
+conversion cycles at the ADC clock of 72MHz / 8. */
+#define ADC_CONVERSION_CLOCKS   328
 
 /* Watchdog Timer Timeout Period in ms */
 #define IWDG_TIMEOUT_MS 1500
@@ -54,6 +67,9 @@ Initial 19 December 2016
 (note only STM32F1xx,  STM32F05x have compatible memory organization). */
 #define FLASH_PAGE_SIZE 2048
 
+/* Supply level below which the power fail warning is raised */
+#define PVD_LEVEL       PWR_CR_PLS_2V9
+
 /* RTC select hardware RTC or software counter */
 #define RTC_SOURCE      RTC
 
@@ -62,7 +78,13 @@ Initial 19 December 2016
 #define NUM_LOADS       2
 #define NUM_SOURCES     1
 #define NUM_INTERFACES  6
-#define NUM_CHANNEL     1 + 2*NUM_INTERFACES
+#define NUM_CHANNEL     (1 + 2*NUM_INTERFACES)
+/* ADC1 and ADC2 convert simultaneously, currents on ADC1 and voltages on ADC2,
+with the temperature on ADC1 matched by a dummy conversion on ADC2. */
+#define ADC_SCAN_LENGTH (1 + NUM_INTERFACES)
+
+/* Maximum number of A/D scans held in each half of the circular DMA buffer */
+#define ADC_SCANS_MAX   32
 
 /* For A/D conversion on the STM32F103RET6 the A/D ports are:
 PA 0-7 is ADC 0-7
@@ -47,28 +47,41 @@ K. Sarkies, 5 August 2017
 /*--------------------------------------------------------------------------*/
 
 void hardware_init(void);
-void set_adc_channel_sequence(uint8_t adc, uint8_t numberChannels, uint8_t* channelArray);
+void set_adc_channel_sequence(uint8_t adc, uint8_t channels, uint8_t* channelArray);
+void set_adc_block_size(uint8_t scans);
 void start_adc_conversion(uint8_t adc);
+void stop_adc_conversion(void);
+void set_adc_sample_rate(uint16_t rate);
+uint32_t get_adc_scan_period(void);
+void set_adc_watchdog(uint8_t channel, uint16_t lowThreshold);
+void clear_adc_watchdog(void);
 void cli(void);
 void sei(void);
-void comms_enable_tx_interrupt(uint8_t enable);
+void comms_transmit_start(void);
+void comms_transmit_hold(void);
+void comms_transmit_release(void);
+void comms_transmit_lend(void);
+void comms_transmit_reclaim(void);
 void flash_read_data(uint32_t *flashBlock, uint8_t *dataBlock, uint16_t size);
 uint32_t flash_write_data(uint32_t *flashBlock, uint8_t *dataBlock, uint16_t size);
 uint32_t get_milliseconds_count();
 uint32_t get_seconds_count();
+uint16_t get_time_milliseconds(uint32_t* seconds);
 void set_seconds_count(uint32_t time);
 uint32_t get_delay_count();
 void set_delay_count(uint32_t time);
-bool adc_eoc_is_set(void);
-uint32_t adc_value(uint8_t channel);
 void clock_setup(void);
 void gpio_setup(void);
 void systick_setup(void);
 void adc_setup(void);
+void timer_adc_setup(void);
 void dma_adc_setup(void);
 void exti_setup(uint32_t exti_enables, uint32_t port);
 void rtc_setup(void);
+void pvd_setup(void);
 void usart1_setup(void);
+void usart1_dma_setup(void);
+void usart1_set_baudrate(uint32_t baudrate);
 void peripheral_enable(void);
 void peripheral_disable(void);
 void set_switch(uint8_t device, uint8_t setting);
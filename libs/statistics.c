@@ -0,0 +1,88 @@
+/*	Streaming Statistics
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+
+Samples are accumulated one at a time as they arrive, with the mean, variance,
+minimum and maximum available at the end of the accumulation period without the
+samples needing to be stored.
+
+Arithmetic is integer only. The variance is returned in the square of the
+sample units, so samples carrying 4 fractional bits give a variance with 8
+fractional bits.
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "statistics.h"
+
+//-----------------------------------------------------------------------------
+
+/* Clear the accumulation, setting the reference to be subtracted from samples.
+The reference should be close to the expected mean. */
+void stats_clear(struct Statistics* stats, uint16_t reference)
+{
+    stats->count = 0;
+    stats->sum = 0;
+    stats->sumSquares = 0;
+    stats->reference = reference;
+    stats->minimum = 0xFFFF;
+    stats->maximum = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Accumulate a sample. The squared difference from the reference always fits
+in 32 bits as an unsigned value. */
+void stats_add_sample(struct Statistics* stats, uint16_t sample)
+{
+    int32_t difference = (int32_t)sample - stats->reference;
+    uint32_t magnitude = (difference < 0) ? -difference : difference;
+    stats->sum += difference;
+    stats->sumSquares += magnitude*magnitude;
+    if (sample < stats->minimum) stats->minimum = sample;
+    if (sample > stats->maximum) stats->maximum = sample;
+    stats->count++;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the mean of the samples accumulated, or the reference if there are
+none. */
+uint16_t stats_mean(struct Statistics* stats)
+{
+    if (stats->count == 0) return stats->reference;
+    return stats->reference + stats->sum/(int64_t)stats->count;
+}
+
+//-----------------------------------------------------------------------------
+
+/* Return the variance of the samples accumulated. This is the mean square
+difference from the reference less the square of the mean difference, which are
+computed with 8 extra fractional bits to preserve precision. */
+uint32_t stats_variance(struct Statistics* stats)
+{
+    if (stats->count == 0) return 0;
+    int64_t meanDifference = (stats->sum*256)/(int64_t)stats->count;
+    uint64_t meanSquare = (stats->sumSquares << 8)/stats->count;
+    uint64_t squareMean = (meanDifference*meanDifference) >> 8;
+    if (squareMean > meanSquare) return 0;
+    uint64_t variance = (meanSquare - squareMean) >> 8;
+    if (variance > 0xFFFFFFFF) return 0xFFFFFFFF;
+    return variance;
+}
+
@@ -0,0 +1,54 @@
+/*	Streaming Statistics
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+
+Fixed point accumulation of mean, variance, minimum and maximum for blocks of
+A/D samples.
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+/* Samples are accumulated as differences from a reference value, normally the
+mean of the previous interval, so that the variance does not suffer from loss
+of precision when the mean is large compared to the spread. */
+struct Statistics
+{
+    uint32_t count;             /* Number of samples accumulated */
+    int64_t sum;                /* Sum of differences from reference */
+    uint64_t sumSquares;        /* Sum of squared differences from reference */
+    uint16_t reference;         /* Value subtracted from each sample */
+    uint16_t minimum;
+    uint16_t maximum;
+};
+
+/*--------------------------------------------------------------------------*/
+/* Prototypes */
+/*--------------------------------------------------------------------------*/
+
+void stats_clear(struct Statistics* stats, uint16_t reference);
+void stats_add_sample(struct Statistics* stats, uint16_t sample);
+uint16_t stats_mean(struct Statistics* stats);
+uint32_t stats_variance(struct Statistics* stats);
+
+#endif
@@ -47,7 +47,21 @@ Convert the global time to an ISO 8601 string.
 
 void put_time_to_string(char* timeString)
 {
-    time_t currentTime = (time_t)get_seconds_count();
+    put_seconds_to_string(get_seconds_count(), timeString);
+}
+
+/*--------------------------------------------------------------------------*/
+/** @brief Return a string containing a given time and date
+
+Convert a time in the form of the global time to an ISO 8601 string.
+
+@param[in] seconds uint32_t. Time as returned by get_seconds_count().
+@param[out] timeString char*. Returns pointer to string with formatted date.
+*/
+
+void put_seconds_to_string(uint32_t seconds, char* timeString)
+{
+    time_t currentTime = (time_t)seconds;
     struct tm *rtc = localtime(&currentTime);
 //    strftime(timeString, sizeof timeString, "%FT%TZ", rtc);
     char buffer[10];
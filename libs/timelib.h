@@ -27,6 +27,7 @@ Initial 25 November 2013 from Battery Management System
 
 void set_time_from_string(char* timeString);
 void put_time_to_string(char* timeString);
+void put_seconds_to_string(uint32_t seconds, char* timeString);
 
 #endif
 
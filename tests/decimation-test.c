@@ -0,0 +1,96 @@
+/*	Decimation Filter Test
+
+Host test of the CIC decimation filters. A constant input must come out as the
+same value with the fractional bits added, at every ratio and order including
+the largest ratio allowed by the bit growth limit.
+
+Build and run on the host from this directory with:
+
+    gcc -std=gnu99 -I../libs -o decimation-test decimation-test.c ../libs/decimation.c
+    ./decimation-test
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "decimation.h"
+
+/* Input value, 12 bits */
+#define SAMPLE      0xABC
+
+//-----------------------------------------------------------------------------
+
+/* Run a constant input through a filter for the settling outputs and two more.
+Returns the number of errors found. */
+static int check_filter(uint8_t order, uint8_t shift)
+{
+    struct Decimator filter;
+    decimator_init(&filter, order, shift);
+    uint32_t ratio = (uint32_t)1 << filter.shift;
+    uint32_t samples = ratio*(filter.order + 2);
+    uint32_t expected = ratio*(filter.order + 1) - 1;
+    uint16_t output = 0;
+    uint8_t outputs = 0;
+    int errors = 0;
+    uint32_t n;
+    for (n = 0; n < samples; n++)
+    {
+        if (! decimator_add(&filter, SAMPLE, &output)) continue;
+        if ((outputs == 0) && (n != expected))
+        {
+            printf("order %d shift %d: first output at sample %u, not %u\n",
+                   filter.order, filter.shift, n, expected);
+            errors++;
+        }
+        if (output != (SAMPLE << DECIMATION_FRACTION_BITS))
+        {
+            printf("order %d shift %d: output %u, not %u\n", filter.order,
+                   filter.shift, output, SAMPLE << DECIMATION_FRACTION_BITS);
+            errors++;
+        }
+        outputs++;
+    }
+    if (outputs != 2)
+    {
+        printf("order %d shift %d: %d outputs, not 2\n", filter.order,
+               filter.shift, outputs);
+        errors++;
+    }
+    return errors;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(void)
+{
+    int errors = 0;
+    uint8_t order;
+    uint8_t shift;
+    for (order = 1; order <= DECIMATION_ORDER_MAX; order++)
+    {
+        for (shift = 0; shift*order <= DECIMATION_GROWTH_MAX; shift++)
+            errors += check_filter(order, shift);
+    }
+/* The largest ratio, above 16 bits, and a ratio that must be reduced */
+    errors += check_filter(1, DECIMATION_GROWTH_MAX);
+    errors += check_filter(2, DECIMATION_GROWTH_MAX);
+    if (errors == 0) printf("Decimation filter test passed\n");
+    return (errors > 0);
+}
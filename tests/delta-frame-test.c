@@ -0,0 +1,238 @@
+/*	Delta Frame Test
+
+Host test of the delta compressed telemetry frames. Two maps send at different
+dividers, so one message is only due in every third interval. Delta frames
+must still be sent between the periodic key frames, and every value must decode
+back to the value sent.
+
+Build and run on the host from this directory with:
+
+    gcc -std=gnu99 -I../libs -o delta-frame-test delta-frame-test.c \
+        ../libs/comms.c ../libs/buffer.c ../libs/stringlib.c
+    ./delta-frame-test
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "buffer.h"
+#include "comms.h"
+
+/* Intervals run, and the divider of the slower map */
+#define INTERVALS   64
+#define DIVIDER     3
+
+/* Object indices of the idents below */
+#define INDEX_DT    1
+#define INDEX_DB    2
+#define INDEX_DI    3
+#define INDEX_DD    4
+
+/* Stand-ins for the firmware */
+const char* const telemetryIndex[] = {"dT", "dB", "dI", "dD", 0};
+union ConfigGroup {int unused;} configData;
+void comms_transmit_start(void) {}
+void comms_transmit_hold(void) {}
+void comms_transmit_release(void) {}
+
+/* Receiver state, by slot */
+static uint8_t layout[DELTA_MESSAGES*3];
+static uint8_t slots = 0;
+static int32_t values[DELTA_VALUES];
+static bool valid[DELTA_MESSAGES];
+static bool synchronized = false;
+
+/* Values expected from the current interval, by object index */
+static int32_t expected[5][2];
+static bool present[5];
+
+static int keyFrames = 0;
+static int deltaFrames = 0;
+static int errors = 0;
+
+//-----------------------------------------------------------------------------
+
+/* Decode a delta frame payload and check its values. */
+
+static void decode_delta(uint8_t* payload, int length)
+{
+    int position = 4;
+    int i, j;
+    if (payload[1] == 0)
+    {
+        keyFrames++;
+        slots = payload[3];
+        for (i = 0; i < slots*3; i++) layout[i] = payload[position++];
+        for (i = 0; i < slots; i++) valid[i] = false;
+        synchronized = true;
+    }
+    else
+    {
+        deltaFrames++;
+        if (! synchronized || (payload[3] != slots))
+        {
+            printf("Delta frame without its layout\n");
+            errors++;
+            return;
+        }
+    }
+    uint8_t* map = payload + position;
+    position += (slots + 7)/8;
+    int start = 0;
+    for (i = 0; i < slots; i++)
+    {
+        uint8_t index = layout[i*3];
+        uint8_t count = layout[i*3+2];
+        if ((map[i/8] >> (i%8)) & 1)
+        {
+            for (j = 0; j < count; j++)
+            {
+                uint32_t value = 0;
+                int shift = 0;
+                uint8_t byte;
+                do
+                {
+                    byte = payload[position++];
+                    value |= (uint32_t)(byte & 0x7F) << shift;
+                    shift += 7;
+                }
+                while (byte & 0x80);
+                int32_t decoded = (int32_t)((value >> 1) ^ (0 - (value & 1)));
+                if (valid[i]) decoded += values[start+j];
+                values[start+j] = decoded;
+                if (! present[index] || (decoded != expected[index][j]))
+                {
+                    printf("Index %d value %d decoded as %d\n",
+                           index, expected[index][j], decoded);
+                    errors++;
+                }
+            }
+            valid[i] = true;
+            present[index] = false;
+        }
+        start += count;
+    }
+    if (position != length)
+    {
+        printf("Frame length %d, decoded %d\n", length, position);
+        errors++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/* Take the queued frames from the send buffer and decode them. */
+
+static void receive(void)
+{
+    uint8_t frame[FRAME_SIZE];
+    uint8_t payload[FRAME_SIZE];
+    int length = 0;
+    uint16_t ch;
+    while ((ch = get_from_send_buffer()) < 0x100)
+    {
+        if (ch != 0)
+        {
+            if (length < FRAME_SIZE) frame[length++] = ch;
+            continue;
+        }
+        if (length == 0) continue;
+        int size = 0;
+        int i = 0;
+        while (i < length)
+        {
+            int code = frame[i++];
+            int k;
+            for (k = 1; (k < code) && (i < length); k++) payload[size++] = frame[i++];
+            if ((code < 255) && (i < length)) payload[size++] = 0;
+        }
+        length = 0;
+        uint16_t crc = 0xFFFF;
+        for (i = 0; i < size-2; i++) crc = crc16_update(crc, payload[i]);
+        if ((size < 6) || (payload[size-2] != (crc & 0xFF))
+                       || (payload[size-1] != (crc >> 8)))
+        {
+            printf("Frame CRC error\n");
+            errors++;
+            continue;
+        }
+        if (payload[0] == INDEX_DD) decode_delta(payload, size-2);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+int main(void)
+{
+    init_comms_buffers();
+    comms_set_output(OUTPUT_SEND);
+    comms_set_binary_frames(true);
+    comms_set_delta_frames(true);
+    receive();
+    int interval;
+    for (interval = 0; interval < INTERVALS; interval++)
+    {
+        comms_telemetry_start();
+        uint64_t due = (1 << (INDEX_DT-1)) | (1 << (INDEX_DB-1));
+        if ((interval % DIVIDER) == 0) due |= 1 << (INDEX_DI-1);
+        comms_set_telemetry_due(due);
+        expected[INDEX_DT][0] = 200 + interval;
+        present[INDEX_DT] = true;
+        send_response("dT", expected[INDEX_DT][0]);
+        expected[INDEX_DI][0] = 1000 - 7*interval;
+        present[INDEX_DI] = ((interval % DIVIDER) == 0);
+        send_response("dI", expected[INDEX_DI][0]);
+        int32_t params[2] = {12000 + interval, -500 - 3*interval};
+        expected[INDEX_DB][0] = params[0];
+        expected[INDEX_DB][1] = params[1];
+        present[INDEX_DB] = true;
+        data_list_send("dB", params, 2);
+        comms_telemetry_end();
+        receive();
+        int i;
+        for (i = 0; i < 5; i++)
+        {
+            if (present[i])
+            {
+                printf("Interval %d index %d not received\n", interval, i);
+                errors++;
+                present[i] = false;
+            }
+        }
+    }
+    int maximumKeys = INTERVALS/DELTA_KEY_INTERVAL + 1;
+    if (keyFrames > maximumKeys)
+    {
+        printf("%d key frames, expected at most %d\n", keyFrames, maximumKeys);
+        errors++;
+    }
+    if (keyFrames + deltaFrames != INTERVALS)
+    {
+        printf("%d frames sent in %d intervals\n", keyFrames + deltaFrames,
+               INTERVALS);
+        errors++;
+    }
+    if (errors == 0) printf("Delta frame test passed, %d key and %d delta frames\n",
+                            keyFrames, deltaFrames);
+    return errors > 0;
+}
+
@@ -0,0 +1,180 @@
+/*	Binary Log Stream Test
+
+Host test of the binary log blocks written through the stream buffers. Records
+are written slowly under the default sync policy, so that timed syncs write out
+the completed blocks while a block is still being filled. Every block must pass
+its CRC and every record must be read back in order.
+
+The file system runs on a RAM disk. Build and run on the host from this
+directory with:
+
+    gcc -std=gnu99 -I../libs -I../chan-fat-stm32-loc3 -o log-stream-test \
+        log-stream-test.c ../libs/file.c ../libs/comms.c ../libs/buffer.c \
+        ../libs/stringlib.c ../chan-fat-stm32-loc3/ff.c
+    ./log-stream-test
+
+Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+*/
+
+/*
+ * Copyright (C) K. Sarkies <ksarkies@internode.on.net>
+ *
+ * This project is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "buffer.h"
+#include "comms.h"
+#include "file.h"
+
+/* Records written, one each second, and the record length */
+#define RECORDS         60
+#define RECORD_WORDS    19
+
+/* RAM disk size in sectors */
+#define DISK_SECTORS    16384
+
+/* Stand-ins for the firmware */
+const char* const telemetryIndex[] = {0};
+union ConfigGroup {int unused;} configData;
+void comms_transmit_start(void) {}
+void comms_transmit_hold(void) {}
+void comms_transmit_release(void) {}
+
+static uint32_t seconds = 0;
+uint32_t get_seconds_count(void) { return seconds; }
+uint32_t get_milliseconds_count(void) { return seconds*1000; }
+
+static uint8_t disk[DISK_SECTORS][_MIN_SS];
+
+//-----------------------------------------------------------------------------
+/* RAM disk */
+
+DWORD get_fattime(void) { return 0; }
+DSTATUS disk_initialize(BYTE pdrv) { return 0; }
+DSTATUS disk_status(BYTE pdrv) { return 0; }
+void disk_set_async(BYTE on) {}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+    if (sector + count > DISK_SECTORS) return RES_PARERR;
+    memcpy(buff, disk[sector], count*_MIN_SS);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+    if (sector + count > DISK_SECTORS) return RES_PARERR;
+    memcpy(disk[sector], buff, count*_MIN_SS);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+    if (cmd == GET_SECTOR_COUNT) *(DWORD*)buff = DISK_SECTORS;
+    else if (cmd == GET_BLOCK_SIZE) *(DWORD*)buff = 1;
+    return RES_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(void)
+{
+    int errors = 0;
+    uint8_t work[_MAX_SS];
+    if (f_mkfs("", FM_FAT, 0, work, sizeof(work)) != FR_OK)
+    {
+        printf("Unable to make the file system\n");
+        return 1;
+    }
+    init_file_system();
+    uint8_t fileHandle = 0xFF;
+    if (open_write_file("LOG.BIN", &fileHandle, 0) != FR_OK)
+    {
+        printf("Unable to open the log file\n");
+        return 1;
+    }
+    uint8_t header[] = "log stream test";
+    write_log_header(fileHandle, header, sizeof(header));
+    int record;
+    for (record = 0; record < RECORDS; record++)
+    {
+        int32_t data[RECORD_WORDS];
+        int i;
+        for (i = 0; i < RECORD_WORDS; i++) data[i] = record*100 + i;
+        write_log_record(fileHandle, (uint8_t*)data, sizeof(data));
+        seconds++;
+        sync_file_poll();
+    }
+    close_file(&fileHandle);
+
+/* Read back the blocks and check the records */
+    FIL fil;
+    if (f_open(&fil, "LOG.BIN", FA_READ) != FR_OK)
+    {
+        printf("Unable to reopen the log file\n");
+        return 1;
+    }
+    uint8_t block[LOG_BLOCK_SIZE];
+    UINT numRead;
+    int blocks = 0;
+    int nextRecord = 0;
+    while ((f_read(&fil, block, LOG_BLOCK_SIZE, &numRead) == FR_OK) &&
+           (numRead == LOG_BLOCK_SIZE))
+    {
+        uint16_t crc = 0xFFFF;
+        int i;
+        for (i = 0; i < LOG_BLOCK_SIZE-2; i++) crc = crc16_update(crc, block[i]);
+        if ((block[LOG_BLOCK_SIZE-2] != (crc & 0xFF)) ||
+            (block[LOG_BLOCK_SIZE-1] != (crc >> 8)))
+        {
+            printf("Block %d failed the CRC\n", blocks);
+            errors++;
+        }
+        else if ((block[4] | (block[5] << 8)) != blocks)
+        {
+            printf("Block %d has sequence %d\n", blocks, block[4] | (block[5] << 8));
+            errors++;
+        }
+        else if (memcmp(block, "DAQB", 4) == 0)
+        {
+            int count = block[LOG_BLOCK_SIZE-4] | (block[LOG_BLOCK_SIZE-3] << 8);
+            int32_t* data = (int32_t*)(block + LOG_BLOCK_HEADER);
+            for (i = 0; i < count; i++, nextRecord++)
+            {
+                if (data[i*RECORD_WORDS] != nextRecord*100)
+                {
+                    printf("Record %d read as %d\n", nextRecord,
+                           data[i*RECORD_WORDS]/100);
+                    errors++;
+                }
+            }
+        }
+        blocks++;
+    }
+    f_close(&fil);
+    if (nextRecord != RECORDS)
+    {
+        printf("%d of %d records read back\n", nextRecord, RECORDS);
+        errors++;
+    }
+    if (errors == 0) printf("Log stream test passed, %d blocks\n", blocks);
+    return errors > 0;
+}
+